@@ -14,7 +14,7 @@
     device->updateStorage(descriptor, 1, batch.materialBuffer, VK_WHOLE_SIZE);
     device->updateSampler(descriptor, 2, samplerGlobal.get(), pool->getTextures());
     device->updateSampler(descriptor, 3, samplerShadow.get(), vk::ImageLayout::eDepthReadOnlyOptimal, std::span(&view, 1));
-    device->updateStorage(descriptor, 4, light, sizeof(ler::SceneParam), true);
+    pipeline->updateStorage(descriptor, 4, upload->getBuffer(), sizeof(ler::SceneParam), light.offset);
     device->updateStorage(descriptor, 5, batch.instanceBuffer, VK_WHOLE_SIZE);
     device->updateStorage(descriptor, 6, batch.commandBuffer, VK_WHOLE_SIZE);
 
@@ -61,8 +61,9 @@ public:
         info.topology = vk::PrimitiveTopology::eTriangleList;
         info.colorAttach.emplace_back(vk::Format::eB8G8R8A8Unorm);
         info.depthAttach = vk::Format::eD32Sfloat;
-        pipeline = device->createGraphicsPipeline(shaders, info);
-        descriptor = pipeline->createDescriptorSet(0);
+        pipeline = device->createGraphicsPipelineAsync(shaders, info);
+        for(vk::DescriptorSet& descriptor : descriptors)
+            descriptor = pipeline->createDescriptorSet(0);
 
         // AABB Pass
         std::vector<ler::ShaderPtr> aabbShaders;
@@ -71,32 +72,40 @@ public:
         info.textureCount = 0;
         info.topology = vk::PrimitiveTopology::eLineList;
         info.lineWidth = 3.f;
-        boxPass = device->createGraphicsPipeline(aabbShaders, info);
+        boxPass = device->createGraphicsPipelineAsync(aabbShaders, info);
 
         // Depth PrePass
         shaders.clear();
         info.colorAttach.clear();
         info.topology = vk::PrimitiveTopology::eTriangleList;
         shaders.emplace_back(device->createShader("depth.vert.spv"));
-        prePass = device->createGraphicsPipeline(shaders, info);
+        prePass = device->createGraphicsPipelineAsync(shaders, info);
         descriptorPrePass = prePass->createDescriptorSet(0);
 
         // PrePass Depth
         device->updateStorage(descriptorPrePass, 0, scene.getInstanceBuffers(), VK_WHOLE_SIZE);
         device->updateStorage(descriptorPrePass, 1, scene.getCommandBuffers(), VK_WHOLE_SIZE);
 
-        m_light = device->createBuffer(sizeof(ler::SceneParam), vk::BufferUsageFlagBits::eUniformBuffer, true);
+        m_upload = device->getUploadAllocator();
         samplerGlobal = device->createSampler(vk::SamplerAddressMode::eRepeat, true);
         samplerShadow = device->createSampler(vk::SamplerAddressMode::eClampToEdge, true);
 
-        // Vertex Shader
-        device->updateStorage(descriptor, 0, scene.getInstanceBuffers(), VK_WHOLE_SIZE);
-        device->updateStorage(descriptor, 6, scene.getCommandBuffers(), VK_WHOLE_SIZE);
+        // The light block is rewritten in render, one set per frame slot
+        for(vk::DescriptorSet descriptor : descriptors)
+        {
+            // Vertex Shader
+            device->updateStorage(descriptor, 0, scene.getInstanceBuffers(), VK_WHOLE_SIZE);
+            device->updateStorage(descriptor, 6, scene.getCommandBuffers(), VK_WHOLE_SIZE);
 
-        // Fragment Shader
-        device->updateStorage(descriptor, 1, scene.getSceneBuffers().getMaterialBuffer(), VK_WHOLE_SIZE);
-        device->updateStorage(descriptor, 4, m_light, sizeof(ler::SceneParam), true);
-        device->updateStorage(descriptor, 5, scene.getInstanceBuffers(), VK_WHOLE_SIZE);
+            // Fragment Shader
+            device->updateStorage(descriptor, 1, scene.getSceneBuffers().getMaterialBuffer(), VK_WHOLE_SIZE);
+            device->updateStorage(descriptor, 5, scene.getInstanceBuffers(), VK_WHOLE_SIZE);
+        }
+
+        // Compiled concurrently, this pass has no fallback while pending
+        pipeline->wait();
+        boxPass->wait();
+        prePass->wait();
 
         /*
         size_t maxContexts = FFX_CLASSIFIER_CONTEXT_COUNT + FFX_DENOISER_CONTEXT_COUNT;
@@ -109,6 +118,9 @@ public:
 
     void resize(const ler::LerDevicePtr& device, vk::Extent2D extent) override
     {
+        // Frames in flight may still render into the previous depth
+        if(m_depth)
+            device->release(m_depth);
         m_depth = device->createTexture(vk::Format::eD32Sfloat, extent, vk::SampleCountFlagBits::e1, true);
         device->initTextureLayout(m_depth, vk::ImageLayout::eDepthStencilAttachmentOptimal, vk::AccessFlagBits::eDepthStencilAttachmentWrite);
         device->setRenderTarget(ler::RT::eDepth, m_depth);
@@ -128,7 +140,8 @@ public:
     {
         ler::log::info("hello scene loaded");
         ler::TexturePoolPtr pool = device->getTexturePool();
-        device->updateSampler(descriptor, 2, samplerGlobal.get(), pool->getTextures());
+        for(vk::DescriptorSet descriptor : descriptors)
+            device->updateSampler(descriptor, 2, samplerGlobal.get(), pool->getTextures());
     }
 
     void render(const ler::LerDevicePtr& device, ler::FrameWindow& frame, ler::RenderSceneList& sceneList, ler::RenderParams& params) override
@@ -170,19 +183,25 @@ public:
         sceneList.drawAABB(cmd);
         cmd->end();
 
-        sceneList.generate(m_depth, cmd);
-        sceneList.sort(cmd, cam, false);
+        // HZB and culling run on the compute queue when available
+        uint64_t cullId = sceneList.cullAsync(device, cmd, m_depth, cam);
+        sceneList.waitCull(device, cmd, m_depth, cullId);
         cmd->executePass({
             .viewport = frame.extent,
             .colorAttachments = {{.texture = frame.image, .loadOp = vk::AttachmentLoadOp::eClear}},
             .depthStencilAttachment = {.texture = m_depth, .loadOp = vk::AttachmentLoadOp::eClear},
         });
+        // The set of this frame slot is no longer read by the GPU
+        vk::DescriptorSet descriptor = descriptors[params.frameIndex];
+        ler::UploadAllocation light = m_upload->upload(params.scene);
+        if(light)
+            pipeline->updateStorage(descriptor, 4, m_upload->getBuffer(), sizeof(ler::SceneParam), light.offset);
         cmd->bindPipeline(pipeline, descriptor);
         cmd->cmdBuf.pushConstants(pipeline->pipelineLayout.get(), vk::ShaderStageFlagBits::eVertex, 0, 128, &cam);
         sceneList.getSceneBuffers().bind(cmd, false);
         sceneList.draw(cmd);
         cmd->end();
-        device->submitAndWait(cmd);
+        device->submitCommand(cmd);
         ImGui::Begin("Scene Renderer", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
         ImGui::Text("DrawCount: %d", sceneList.getDrawCount());
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
@@ -197,8 +216,8 @@ private:
     vk::UniqueSampler samplerGlobal;
     vk::UniqueSampler samplerShadow;
     ler::TexturePtr m_depth;
-    ler::BufferPtr m_light;
-    vk::DescriptorSet descriptor = nullptr;
+    ler::UploadAllocatorPtr m_upload;
+    std::array<vk::DescriptorSet, ler::kMaxFramesInFlight> descriptors = {};
     vk::DescriptorSet descriptorPrePass = nullptr;
 };
 
@@ -220,7 +239,7 @@ public:
         //info.topology = vk::PrimitiveTopology::eTriangleStrip;
         info.colorAttach.emplace_back(vk::Format::eB8G8R8A8Unorm);
         info.depthAttach = vk::Format::eD32Sfloat;
-        pipeline = device->createGraphicsPipeline(shaders, info);
+        pipeline = device->createGraphicsPipelineAsync(shaders, info);
         graph.getResource(resources[1].handle, m_drawsBuffer);
         graph.getResource(resources[2].handle, m_countBuffer);
     }
@@ -256,9 +275,15 @@ public:
 
     void create(const ler::LerDevicePtr& device, ler::RenderGraph& graph, std::span<ler::RenderDesc> resources) override
     {
+        // One workgroup per subgroup, frustum only since the graph binds no depth pyramid
+        ler::SpecConstants constants;
+        constants[0] = device->getVulkanContext().subgroupSize;
+        constants[2] = VK_FALSE;
+        m_groupSize = constants[0];
         ler::ShaderPtr shader = device->createShader("generate_draws.comp.spv");
-        pipeline = device->createComputePipeline(shader);
-        graph.getResource(resources[2].handle, m_frustumBuffer);
+        pipeline = device->createComputePipelineAsync(shader, constants, true);
+        m_upload = device->getUploadAllocator();
+        m_frustumSize = resources[2].buffer.byteSize;
         graph.getResource(resources[4].handle, m_visibleBuffer);
     }
 
@@ -266,21 +291,44 @@ public:
 
     [[nodiscard]] std::string getName() const override { return "CullingPass"; }
 
-    void render(ler::CommandPtr& cmd, const ler::SceneBuffers& sb, ler::RenderParams params) override
+    std::vector<uint32_t> uploadConstants(const ler::RenderParams& params) override
     {
+        // The frustum binding is a dynamic uniform over the upload buffer, sized by the graph
         m_frustum.cull = 0;
         m_frustum.num = params.scene.instanceCount;
         m_frustum.camera = params.camera.test;
-        ler::CameraParam& camera = params.camera;
-        m_visibleBuffer->getUint(&drawCount);
+        const ler::CameraParam& camera = params.camera;
         ler::LerDevice::getFrustumPlanes(camera.proj * camera.view, m_frustum.planes);
         ler::LerDevice::getFrustumCorners(camera.proj * camera.view, m_frustum.corners);
-        static constexpr uint32_t resetNum = 0;
-        m_visibleBuffer->uploadFromMemory(&resetNum, sizeof(uint32_t));
-        m_frustumBuffer->uploadFromMemory(&m_frustum, sizeof(Frustum));
+        ler::UploadAllocation frustum = m_upload->allocate(std::max<uint32_t>(m_frustumSize, sizeof(Frustum)));
+        if(!frustum)
+            return {0};
+        std::memcpy(frustum.data, &m_frustum, sizeof(Frustum));
+        return {frustum.offset};
+    }
+
+    void render(ler::CommandPtr& cmd, const ler::SceneBuffers& sb, ler::RenderParams params) override
+    {
+        ler::CameraParam& camera = params.camera;
+
+        // Reset the count on the GPU, previous frames may still read it
+        using ps = vk::PipelineStageFlagBits2;
+        using ac = vk::AccessFlagBits2;
+        vk::BufferMemoryBarrier2 barrier;
+        barrier.setBuffer(m_visibleBuffer->handle).setSize(VK_WHOLE_SIZE);
+        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED).setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.setSrcStageMask(ps::eComputeShader).setSrcAccessMask(ac::eShaderWrite);
+        barrier.setDstStageMask(ps::eTransfer).setDstAccessMask(ac::eTransferWrite);
+        cmd->addBarriers({}, std::span(&barrier, 1));
+        cmd->flushBarriers();
+        cmd->cmdBuf.fillBuffer(m_visibleBuffer->handle, 0, sizeof(uint32_t), 0);
+        barrier.setSrcStageMask(ps::eTransfer).setSrcAccessMask(ac::eTransferWrite);
+        barrier.setDstStageMask(ps::eComputeShader).setDstAccessMask(ac::eShaderRead | ac::eShaderWrite);
+        cmd->addBarriers({}, std::span(&barrier, 1));
+        cmd->flushBarriers();
 
         cmd->cmdBuf.pushConstants(pipeline->pipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, 128, &camera);
-        cmd->cmdBuf.dispatch(1 + m_frustum.num / 64, 1, 1);
+        cmd->cmdBuf.dispatch((params.scene.instanceCount + m_groupSize - 1) / m_groupSize, 1, 1);
     }
 
 private:
@@ -288,9 +336,10 @@ private:
     Frustum m_frustum;
     ler::PipelinePtr pipeline;
     vk::DescriptorSet descriptor;
-    ler::BufferPtr m_frustumBuffer;
+    ler::UploadAllocatorPtr m_upload;
+    uint32_t m_frustumSize = 0;
+    uint32_t m_groupSize = 64;
     ler::BufferPtr m_visibleBuffer;
-    uint32_t drawCount = 0;
 };
 
 class GBufferPass : public ler::RenderGraphPass
@@ -312,7 +361,7 @@ public:
         info.colorAttach.emplace_back(vk::Format::eR16G16B16A16Sfloat);
         info.colorAttach.emplace_back(vk::Format::eR8G8B8A8Unorm);
         info.depthAttach = vk::Format::eD32Sfloat;
-        pipeline = device->createGraphicsPipeline(shaders, info);
+        pipeline = device->createGraphicsPipelineAsync(shaders, info);
         graph.getResource(resources[1].handle, m_drawsBuffer);
         graph.getResource(resources[2].handle, m_countBuffer);
     }
@@ -357,7 +406,7 @@ public:
         info.polygonMode = vk::PolygonMode::eFill;
         info.topology = vk::PrimitiveTopology::eTriangleStrip;
         info.colorAttach.emplace_back(vk::Format::eB8G8R8A8Unorm);
-        pipeline = device->createGraphicsPipeline(shaders, info);
+        pipeline = device->createGraphicsPipelineAsync(shaders, info);
     }
 
     [[nodiscard]] ler::PipelinePtr getPipeline() const override { return pipeline; }
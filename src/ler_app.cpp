@@ -35,10 +35,34 @@ namespace ler
             log::exit("Failed to init glfw");
 
         // Init filesystem
-        FileSystemService::Get().mount(FsTag_Cache, StdFileSystem::Create(CACHED_DIR));
-        FileSystemService::Get().mount(FsTag_Assets, StdFileSystem::Create(ASSETS_DIR));
+        CacheService::Get().setBudget(m_config.cacheBudget);
+        FileSystemService::Get().mount(FsTag_Cache, CacheFileSystem::Create(CACHED_DIR));
+        if(fs::exists(ASSETS_PAK))
+        {
+            FileSystemService::Get().mount(FsTag_Assets, PakFileSystem::Create(ASSETS_PAK));
+        }
+        else
+        {
+            FileSystemService::Get().mount(FsTag_Assets, StdFileSystem::Create(ASSETS_DIR));
+            FileSystemService::Get().watch(FsTag_Assets);
+        }
         FileSystemService::Get().mount(FsTag_Default, StdFileSystem::Create(""));
 
+        // SPIR-V is prebuilt by ler_shaderc, runtime compilation is a development override
+#ifdef LER_SHADER_COMPILER
+        if(!m_config.shaderAutoCompile && !fs::exists(SHADER_DIR))
+        {
+            log::warn("No prebuilt shaders in {}, compile at runtime", SHADER_DIR.string());
+            m_config.shaderAutoCompile = true;
+        }
+#else
+        m_config.shaderAutoCompile = false;
+#endif
+        if(m_config.shaderAutoCompile)
+            FileSystemService::Get().mount(FsTag_Shaders, FileSystemService::Get().fileSystem(FsTag_Cache));
+        else
+            FileSystemService::Get().mount(FsTag_Shaders, StdFileSystem::Create(SHADER_DIR));
+
         // Init window
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
         glfwWindowHint(GLFW_RESIZABLE, cfg.resizable);
@@ -61,14 +85,21 @@ namespace ler
         m_vulkan = std::make_unique<VulkanInitializer>(cfg);
         const VulkanContext& context = m_vulkan->getVulkanContext();
 
+#ifdef LER_SHADER_COMPILER
         // Init Glslang
-        m_glslang = std::make_unique<GlslangInitializer>();
+        if(m_config.shaderAutoCompile)
+        {
+            m_glslang = std::make_unique<GlslangInitializer>();
+            GlslangInitializer::setReleaseMode(m_config.shaderRelease);
+        }
+#endif
 
         // Init PhysX
         m_physx = std::make_unique<PXInitializer>();
 
         // Init device
         m_device = std::make_shared<LerDevice>(context);
+        m_device->setFramesInFlight(m_config.framesInFlight);
 
         // Init AS Memory Util
         m_rtxMemUtil = std::make_unique<rtxmu::VkAccelStructManager>(context.instance, context.device, context.physicalDevice);
@@ -87,7 +118,10 @@ namespace ler
 
         updateSwapChain();
 
-        GlslangInitializer::shaderAutoCompile();
+#ifdef LER_SHADER_COMPILER
+        if(m_config.shaderAutoCompile)
+            GlslangInitializer::shaderAutoCompile();
+#endif
 
         bindController(std::make_shared<FpsCamera>());
         m_controller->updateMatrices();
@@ -110,6 +144,8 @@ namespace ler
             m_scene.renderList.addPerDraw(m, t, info.get());
         });*/
 
+        Event::GetDispatcher().sink<FileChangeEvent>().connect<&LerApp::onFileChange>(this);
+
         m_world.observer<CPhysic>().event(flecs::OnSet).each([&](flecs::entity e, CPhysic& p) {
             m_physx->getScene()->addActor(*p.actor);
         });
@@ -125,6 +161,25 @@ namespace ler
         });
     }
 
+    void LerApp::onFileChange(const FileChangeEvent& e)
+    {
+#ifdef LER_SHADER_COMPILER
+        if(e.tag == FsTag_Assets && m_config.shaderAutoCompile)
+        {
+            GlslangInitializer::reloadAsync(e.path, [](const std::string& name)
+            {
+                AsyncQueue<AsyncRequest>::Commit(SubmitShader(name));
+            });
+        }
+#endif
+
+        if(!SceneImporter::ReloadScene(m_device, m_world, e))
+            return;
+
+        if(m_selected != flecs::entity::null() && !m_selected.is_alive())
+            m_selected = flecs::entity::null();
+    }
+
     void LerApp::autoExec()
     {
         fs::path path(getHomeDir());
@@ -142,6 +197,10 @@ namespace ler
         m_config.msaa = reader.GetInteger("engine", "msaa", 1);
 
         m_config.debug = reader.GetBoolean("debug", "enable", true);
+        m_config.shaderRelease = reader.GetBoolean("engine", "shader_release", false);
+        m_config.shaderAutoCompile = reader.GetBoolean("engine", "shader_autocompile", false);
+        m_config.framesInFlight = reader.GetInteger("engine", "frames_in_flight", 2);
+        m_config.cacheBudget = reader.GetInteger("cache", "budget", 512) * 1024ull * 1024ull;
     }
 
     void LerApp::updateWindowIcon(const fs::path& path)
@@ -157,13 +216,32 @@ namespace ler
     void LerApp::updateSwapChain()
     {
         const VulkanContext& context = m_vulkan->getVulkanContext();
-        context.device.waitIdle();
-        m_swapChain = SwapChain::create(context, m_surface.get(), m_config.width, m_config.height, m_config.vsync);
+
+        // Members go in reverse order, image views before the swapchain owning their images
+        struct Retired
+        {
+            vk::UniqueSwapchainKHR swapChain;
+            std::vector<vk::UniqueSemaphore> semaphores;
+            std::vector<TexturePtr> images;
+        };
+
+        // Nothing is drained, frames in flight keep the old swapchain until their submissions complete
+        // and passes only rewrite the descriptor sets of retired frame slots
+        auto retired = std::make_shared<Retired>();
+        retired->swapChain = std::move(m_swapChain.handle);
+        retired->semaphores = std::move(m_presentSemaphores);
+        retired->images = std::move(m_images);
+        m_swapChain = SwapChain::create(context, m_surface.get(), m_config.width, m_config.height, m_config.vsync, retired->swapChain.get());
+        m_device->release(retired);
 
         m_images.clear();
+        m_presentSemaphores.clear();
         auto swapChainImages = context.device.getSwapchainImagesKHR(m_swapChain.handle.get());
         for(auto& image : swapChainImages)
+        {
             m_images.emplace_back(m_device->createTextureFromNative(image, m_swapChain.format, m_swapChain.extent));
+            m_presentSemaphores.emplace_back(context.device.createSemaphoreUnique({}));
+        }
 
         for(size_t i = 0; i < m_images.size(); ++i)
         {
@@ -188,7 +266,7 @@ namespace ler
             barrier.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
             cmd->cmdBuf.pipelineBarrier(ps::eAllCommands, ps::eAllCommands, vk::DependencyFlags(), {}, {}, imageBarriers);
         }
-        m_device->submitOneshot(cmd);
+        m_device->submitCommand(cmd);
     }
 
     void LerApp::notifyResize()
@@ -217,7 +295,11 @@ namespace ler
         uint32_t swapChainIndex = 0;
         const VulkanContext& context = m_vulkan->getVulkanContext();
         vk::Queue queue = context.device.getQueue(context.graphicsQueueFamily, 0);
-        auto presentSemaphore = context.device.createSemaphoreUnique({});
+
+        // Acquire is per frame in flight, present is per swapchain image
+        std::array<vk::UniqueSemaphore, kMaxFramesInFlight> acquireSemaphores;
+        for(auto& semaphore : acquireSemaphores)
+            semaphore = context.device.createSemaphoreUnique({});
 
         double x, y;
 
@@ -232,12 +314,19 @@ namespace ler
         {
             glfwPollEvents();
 
+            // Throttle the CPU to the frames in flight
+            m_device->beginFrame();
+            const uint32_t frameIndex = m_device->getFrameIndex();
+            vk::Semaphore acquireSemaphore = acquireSemaphores[frameIndex].get();
+            m_renderer.setFrameIndex(frameIndex);
+
             // Acquire next frame
-            result = context.device.acquireNextImageKHR(m_swapChain.handle.get(), std::numeric_limits<uint64_t>::max(), presentSemaphore.get(), vk::Fence(), &swapChainIndex);
+            result = context.device.acquireNextImageKHR(m_swapChain.handle.get(), std::numeric_limits<uint64_t>::max(), acquireSemaphore, vk::Fence(), &swapChainIndex);
             assert(result == vk::Result::eSuccess);
+            vk::Semaphore presentSemaphore = m_presentSemaphores[swapChainIndex].get();
 
             // All commands will now wait next image
-            m_device->queueWaitForSemaphore(CommandQueue::Graphics, presentSemaphore.get(), 0);
+            m_device->queueWaitForSemaphore(CommandQueue::Graphics, acquireSemaphore, 0);
 
             // Layout transition
             cmd = m_device->createCommand();
@@ -264,6 +353,10 @@ namespace ler
             camera.test = glm::vec4(m_controller->getEyePosition(), m_controller->getNearClip());
             //camera.proj[1][1] *= -1;
 
+            // Stream assets closest to the camera first
+            LoadScheduler::Get().update(camera);
+            m_device->getTexturePool()->flush();
+
             if(m_selected != flecs::entity::null())
             {
                 const auto* t = m_selected.get<CTransform>();
@@ -287,33 +380,45 @@ namespace ler
 
             // Render
             RenderParams params(camera);
+            params.frameIndex = frameIndex;
             params.scene.instanceCount = m_renderer.getInstanceCount();
 
             cmd = m_device->createCommand();
-            m_graph.execute(cmd, m_targets[swapChainIndex].image, m_renderer.getSceneBuffers(), params);
+            if(m_device->getTexturePool()->retire(cmd))
+            {
+                // Reloaded textures have new views
+                m_graph.onSceneChange(&m_renderer.getSceneBuffers());
+                for(auto& pass : m_renderPasses)
+                    pass->onSceneChange(m_device, &m_renderer.getSceneBuffers());
+            }
             m_device->submitCommand(cmd);
+            m_graph.execute(m_device, m_targets[swapChainIndex].image, m_renderer.getSceneBuffers(), params);
 
             for(auto& pass : m_renderPasses)
                 pass->render(m_device, m_targets[swapChainIndex], m_renderer, params);
 
             // Next command will signal present image
-            m_device->queueSignalSemaphore(CommandQueue::Graphics, presentSemaphore.get(), 0);
+            m_device->queueSignalSemaphore(CommandQueue::Graphics, presentSemaphore, 0);
 
             // Layout transition
             cmd = m_device->createCommand();
             cmd->addImageBarrier(m_images[swapChainIndex], Present);
             m_device->submitCommand(cmd);
 
+            // Whole frame in as few submits as possible
+            m_device->flushCommands();
+
             // Present
             vk::PresentInfoKHR presentInfo;
             presentInfo.setWaitSemaphoreCount(1);
-            presentInfo.setPWaitSemaphores(&presentSemaphore.get());
+            presentInfo.setPWaitSemaphores(&presentSemaphore);
             presentInfo.setSwapchainCount(1);
             presentInfo.setPSwapchains(&m_swapChain.handle.get());
             presentInfo.setPImageIndices(&swapChainIndex);
 
             result = queue.presentKHR(&presentInfo);
             assert(result == vk::Result::eSuccess);
+            m_device->endFrame();
 
             for(SceneBuffers* s : SceneImporter::PollUpdate(m_device, m_world))
             {
@@ -323,6 +428,7 @@ namespace ler
             }
 
             AsyncQueue<AsyncRequest>::Update(*this);
+            FileSystemService::Get().poll();
             Event::GetDispatcher().update();
             m_device->runGarbageCollection();
         }
@@ -330,7 +436,10 @@ namespace ler
         // Stall device
         Async::GetPool().reset(); // Silly because the pool keep last task...
         context.device.waitIdle();
+        m_device->runGarbageCollection();
         Service::Destroy();
+        CacheService::Get().flush();
+        Event::GetDispatcher().sink<FileChangeEvent>().disconnect<&LerApp::onFileChange>(this);
         for(auto& pass : m_renderPasses)
             pass->clean();
     }
@@ -8,8 +8,12 @@
 #include "ler_dev.hpp"
 #include "ler_scn.hpp"
 #include "ler_sys.hpp"
+#include "ler_pak.hpp"
+#include "ler_cache.hpp"
 #include "ler_svc.hpp"
+#ifdef LER_SHADER_COMPILER
 #include "ler_spv.hpp"
+#endif
 #include "ler_gui.hpp"
 #include "ler_img.hpp"
 #include "ler_cam.hpp"
@@ -53,10 +57,20 @@ namespace ler
 
         void operator()(SubmitTexture& submit)
         {
+            if(!submit.texture)
+            {
+                m_device->getTexturePool()->fail(submit.id);
+                return;
+            }
             uint64_t submissionId = m_device->submitCommand(submit.command);
             m_device->getTexturePool()->set(submit.id, submit.texture, submissionId);
         }
 
+        void operator()(SubmitShader& submit)
+        {
+            m_device->rebuildPipelines(submit.name);
+        }
+
         void operator()(SubmitScene& submit)
         {
             SceneImporter::SceneSubmissionPtr submission = submit.submission;
@@ -74,18 +88,22 @@ namespace ler
         void updateSwapChain();
         void notifyResize();
         void updateWindowIcon(const fs::path& path);
+        void onFileChange(const FileChangeEvent& e);
 
         void autoExec();
 
         LerConfig m_config;
         GLFWwindow* m_window = nullptr;
         std::unique_ptr<VulkanInitializer> m_vulkan;
+#ifdef LER_SHADER_COMPILER
         std::unique_ptr<GlslangInitializer> m_glslang;
+#endif
         std::unique_ptr<PXInitializer> m_physx;
         std::shared_ptr<LerDevice> m_device;
         vk::UniqueSurfaceKHR m_surface;
         SwapChain m_swapChain;
         std::vector<TexturePtr> m_images;
+        std::vector<vk::UniqueSemaphore> m_presentSemaphores;
         std::array<FrameWindow, 3> m_targets;
         std::vector<std::shared_ptr<IRenderPass>> m_renderPasses;
         std::unique_ptr<rtxmu::VkAccelStructManager> m_rtxMemUtil;
@@ -0,0 +1,339 @@
+//
+// Created by loulfy on 19/10/2026.
+//
+
+#include "ler_cache.hpp"
+#include "ler_log.hpp"
+
+#include <set>
+#include <charconv>
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+namespace ler
+{
+    static const fs::path CACHE_INDEX = "index.json";
+    static const fs::path CACHE_OBJECTS = "objects";
+
+    CacheKey& CacheKey::add(std::span<const char> data)
+    {
+        for(char c : data)
+        {
+            m_hash ^= static_cast<uint8_t>(c);
+            m_hash *= 0x100000001b3ull;
+        }
+        return *this;
+    }
+
+    CacheService& CacheService::Get()
+    {
+        static CacheService cache;
+        return std::ref(cache);
+    }
+
+    CacheService::~CacheService()
+    {
+        flush();
+    }
+
+    std::string CacheService::ToString(Key key)
+    {
+        std::string str(16, '0');
+        std::array<char, 16> digits = {};
+        auto res = std::to_chars(digits.data(), digits.data() + digits.size(), key, 16);
+        auto count = static_cast<size_t>(res.ptr - digits.data());
+        std::copy_n(digits.data(), count, str.end() - static_cast<std::ptrdiff_t>(count));
+        return str;
+    }
+
+    fs::path CacheService::objectPath(Key key) const
+    {
+        return m_root / CACHE_OBJECTS / ToString(key);
+    }
+
+    void CacheService::open(const fs::path& root)
+    {
+        std::lock_guard lock(m_mutex);
+        m_root = root;
+        m_entries.clear();
+        m_aliases.clear();
+        m_byteSize = 0;
+        m_clock = 0;
+        fs::create_directories(m_root / CACHE_OBJECTS);
+
+        std::ifstream file(m_root / CACHE_INDEX);
+        if(file.is_open())
+        {
+            try
+            {
+                json index = json::parse(file);
+                if(index.at("version").get<uint32_t>() == kIndexVersion)
+                {
+                    m_clock = index.at("clock").get<uint64_t>();
+                    for(const auto& [name, e] : index.at("entries").items())
+                    {
+                        Entry& entry = m_entries[std::stoull(name, nullptr, 16)];
+                        entry.size = e.at("size").get<uint64_t>();
+                        entry.checksum = e.at("checksum").get<uint64_t>();
+                        entry.access = e.at("access").get<uint64_t>();
+                    }
+                    for(const auto& [name, key] : index.at("aliases").items())
+                        m_aliases.emplace(name, std::stoull(key.get<std::string>(), nullptr, 16));
+                }
+            }
+            catch(const std::exception& e)
+            {
+                log::warn("Discard cache index: {}", e.what());
+                m_entries.clear();
+                m_aliases.clear();
+            }
+        }
+
+        // Drop entries whose object is missing, and objects unknown to the index (interrupted write)
+        std::error_code ec;
+        std::erase_if(m_entries, [&](const auto& it){ return fs::file_size(objectPath(it.first), ec) != it.second.size; });
+        for(const auto& object : fs::directory_iterator(m_root / CACHE_OBJECTS))
+        {
+            Key key = 0;
+            const std::string name = object.path().filename().string();
+            auto res = std::from_chars(name.data(), name.data() + name.size(), key, 16);
+            if(res.ec != std::errc() || res.ptr != name.data() + name.size() || !m_entries.contains(key))
+                fs::remove(object.path(), ec);
+        }
+        std::erase_if(m_aliases, [&](const auto& it){ return !m_entries.contains(it.second); });
+
+        for(const auto& entry : m_entries)
+            m_byteSize += entry.second.size;
+
+        log::info("Cache: {} objects, {} Mo", m_entries.size(), m_byteSize / (1024 * 1024));
+        evict();
+    }
+
+    void CacheService::setBudget(uint64_t byteSize)
+    {
+        std::lock_guard lock(m_mutex);
+        m_budget = byteSize;
+        evict();
+    }
+
+    uint64_t CacheService::getByteSize() const
+    {
+        std::lock_guard lock(m_mutex);
+        return m_byteSize;
+    }
+
+    bool CacheService::contains(Key key) const
+    {
+        std::lock_guard lock(m_mutex);
+        return m_entries.contains(key);
+    }
+
+    uint64_t CacheService::size(Key key) const
+    {
+        std::lock_guard lock(m_mutex);
+        auto it = m_entries.find(key);
+        return it == m_entries.end() ? 0 : it->second.size;
+    }
+
+    std::optional<Blob> CacheService::load(Key key)
+    {
+        Entry entry;
+        {
+            std::lock_guard lock(m_mutex);
+            auto it = m_entries.find(key);
+            if(it == m_entries.end())
+                return {};
+            it->second.access = ++m_clock;
+            entry = it->second;
+            m_dirty = true;
+        }
+
+        std::ifstream file(objectPath(key), std::ios::in | std::ios::binary);
+        Blob blob(entry.size);
+        if(file.is_open())
+            file.read(blob.data(), static_cast<std::streamsize>(blob.size()));
+
+        if(!file || CacheKey().add(blob).get() != entry.checksum)
+        {
+            log::warn("Corrupted cache object: {}", ToString(key));
+            std::lock_guard lock(m_mutex);
+            remove(key);
+            return {};
+        }
+
+        return blob;
+    }
+
+    bool CacheService::store(Key key, std::span<const char> data)
+    {
+        // Objects are immutable, a key is written once
+        if(contains(key))
+            return true;
+
+        // It would evict everything else and then itself
+        if(data.size() > m_budget)
+        {
+            log::warn("Cache object larger than the budget: {} ({} Mo)", ToString(key), data.size() / (1024 * 1024));
+            return false;
+        }
+
+        if(!writeFileAtomic(objectPath(key), data))
+        {
+            log::error("Failed to write cache object: {}", ToString(key));
+            return false;
+        }
+
+        std::lock_guard lock(m_mutex);
+        auto [it, inserted] = m_entries.try_emplace(key, data.size(), CacheKey().add(data).get(), ++m_clock);
+        if(inserted)
+            m_byteSize += data.size();
+        m_dirty = true;
+        evict();
+        return true;
+    }
+
+    void CacheService::alias(const std::string& name, Key key)
+    {
+        std::lock_guard lock(m_mutex);
+        if(!m_entries.contains(key))
+            return;
+        auto [it, inserted] = m_aliases.try_emplace(name, key);
+        if(inserted || it->second != key)
+        {
+            it->second = key;
+            m_dirty = true;
+        }
+    }
+
+    std::optional<CacheService::Key> CacheService::resolve(const std::string& name) const
+    {
+        std::lock_guard lock(m_mutex);
+        auto it = m_aliases.find(name);
+        if(it == m_aliases.end())
+            return {};
+        return it->second;
+    }
+
+    void CacheService::enumerates(std::vector<fs::path>& entries) const
+    {
+        std::lock_guard lock(m_mutex);
+        for(const auto& alias : m_aliases)
+            entries.emplace_back(alias.first);
+    }
+
+    void CacheService::remove(Key key)
+    {
+        auto it = m_entries.find(key);
+        if(it == m_entries.end())
+            return;
+
+        std::error_code ec;
+        fs::remove(objectPath(key), ec);
+        m_byteSize -= it->second.size;
+        m_entries.erase(it);
+        std::erase_if(m_aliases, [key](const auto& alias){ return alias.second == key; });
+        m_dirty = true;
+    }
+
+    void CacheService::evict()
+    {
+        if(m_byteSize <= m_budget)
+            return;
+
+        // Least recently used first, aliased objects are pinned
+        std::set<Key> pinned;
+        for(const auto& alias : m_aliases)
+            pinned.insert(alias.second);
+
+        std::vector<std::pair<uint64_t,Key>> order;
+        order.reserve(m_entries.size());
+        for(const auto& [key, entry] : m_entries)
+        {
+            if(!pinned.contains(key))
+                order.emplace_back(entry.access, key);
+        }
+        std::ranges::sort(order);
+
+        for(const auto& [access, key] : order)
+        {
+            if(m_byteSize <= m_budget)
+                break;
+            log::debug("Evict cache object: {}", ToString(key));
+            remove(key);
+        }
+    }
+
+    void CacheService::flush()
+    {
+        std::lock_guard lock(m_mutex);
+        if(!m_dirty || m_root.empty())
+            return;
+
+        json index;
+        index["version"] = kIndexVersion;
+        index["clock"] = m_clock;
+        index["entries"] = json::object();
+        index["aliases"] = json::object();
+        for(const auto& [key, entry] : m_entries)
+            index["entries"][ToString(key)] = {{"size", entry.size}, {"checksum", entry.checksum}, {"access", entry.access}};
+        for(const auto& [name, key] : m_aliases)
+            index["aliases"][name] = ToString(key);
+
+        const std::string dump = index.dump();
+        if(writeFileAtomic(m_root / CACHE_INDEX, dump))
+            m_dirty = false;
+        else
+            log::error("Failed to write cache index");
+    }
+
+    CacheFileSystem::CacheFileSystem(const fs::path& root) : m_root(root)
+    {
+        CacheService::Get().open(root);
+    }
+
+    Blob CacheFileSystem::readFile(const fs::path& path)
+    {
+        auto& cache = CacheService::Get();
+        auto key = cache.resolve(path.generic_string());
+        if(!key.has_value())
+            throw std::runtime_error("File Not Found: " + path.string());
+
+        auto blob = cache.load(key.value());
+        if(!blob.has_value())
+            throw std::runtime_error("Cache Miss: " + path.string());
+        return std::move(blob.value());
+    }
+
+    bool CacheFileSystem::exists(const fs::path& path) const
+    {
+        auto& cache = CacheService::Get();
+        auto key = cache.resolve(path.generic_string());
+        return key.has_value() && cache.contains(key.value());
+    }
+
+    void CacheFileSystem::enumerates(std::vector<fs::path>& entries)
+    {
+        CacheService::Get().enumerates(entries);
+    }
+
+    fs::file_time_type CacheFileSystem::last_write_time(const fs::path& path)
+    {
+        auto key = CacheService::Get().resolve(path.generic_string());
+        if(!key.has_value())
+            return {};
+        std::error_code ec;
+        return fs::last_write_time(m_root / CACHE_OBJECTS / CacheService::ToString(key.value()), ec);
+    }
+
+    fs::path CacheFileSystem::format_hint(const fs::path& path)
+    {
+        return path.extension();
+    }
+
+    uint64_t CacheFileSystem::file_size(const fs::path& path)
+    {
+        auto& cache = CacheService::Get();
+        auto key = cache.resolve(path.generic_string());
+        return key.has_value() ? cache.size(key.value()) : 0;
+    }
+}
@@ -0,0 +1,104 @@
+//
+// Created by loulfy on 19/10/2026.
+//
+
+#ifndef LER_CACHE_HPP
+#define LER_CACHE_HPP
+
+#include "ler_sys.hpp"
+
+#include <map>
+#include <mutex>
+#include <optional>
+
+namespace ler
+{
+    // FNV-1a, stable across runs and platforms
+    class CacheKey
+    {
+    public:
+
+        explicit CacheKey(uint32_t version = 0) { add(version); }
+        CacheKey& add(std::span<const char> data);
+        CacheKey& add(std::string_view str) { return add(std::span(str.data(), str.size())); }
+        CacheKey& add(uint64_t value) { return add(std::span(reinterpret_cast<const char*>(&value), sizeof(value))); }
+        [[nodiscard]] uint64_t get() const { return m_hash; }
+
+    private:
+
+        uint64_t m_hash = 0xcbf29ce484222325ull;
+    };
+
+    class CacheService
+    {
+    public:
+
+        using Key = uint64_t;
+
+        static CacheService& Get();
+        static std::string ToString(Key key);
+
+        void open(const fs::path& root);
+        void setBudget(uint64_t byteSize);
+        [[nodiscard]] uint64_t getByteSize() const;
+
+        [[nodiscard]] bool contains(Key key) const;
+        [[nodiscard]] uint64_t size(Key key) const;
+        std::optional<Blob> load(Key key);
+        bool store(Key key, std::span<const char> data);
+
+        // Stable names (e.g. "mesh.vert.spv") pointing to the latest object, aliased objects are never evicted
+        void alias(const std::string& name, Key key);
+        [[nodiscard]] std::optional<Key> resolve(const std::string& name) const;
+        void enumerates(std::vector<fs::path>& entries) const;
+
+        void flush();
+
+    private:
+
+        struct Entry
+        {
+            uint64_t size = 0;
+            uint64_t checksum = 0;
+            uint64_t access = 0;
+        };
+
+        CacheService() = default;
+        ~CacheService();
+
+        [[nodiscard]] fs::path objectPath(Key key) const;
+        void remove(Key key);
+        void evict();
+
+        static constexpr uint32_t kIndexVersion = 1;
+        static constexpr uint64_t kDefaultBudget = 512ull * 1024 * 1024;
+
+        mutable std::mutex m_mutex;
+        fs::path m_root;
+        std::map<Key,Entry> m_entries;
+        std::map<std::string,Key> m_aliases;
+        uint64_t m_budget = kDefaultBudget;
+        uint64_t m_byteSize = 0;
+        uint64_t m_clock = 0;
+        bool m_dirty = false;
+    };
+
+    class CacheFileSystem : public FileSystem<CacheFileSystem>
+    {
+    public:
+
+        explicit CacheFileSystem(const fs::path& root);
+        Blob readFile(const fs::path& path) override;
+        [[nodiscard]] bool exists(const fs::path& path) const override;
+        void enumerates(std::vector<fs::path>& entries) override;
+        [[nodiscard]] fs::file_time_type last_write_time(const fs::path& path) override;
+        fs::path format_hint(const fs::path& path) override;
+        [[nodiscard]] uint64_t file_size(const fs::path& path) override;
+
+    private:
+
+        fs::path m_root;
+    };
+}
+
+#endif //LER_CACHE_HPP
@@ -8,61 +8,147 @@ namespace ler
 {
     TrackedCommandBuffer::~TrackedCommandBuffer()
     {
-        m_context.device.destroyCommandPool(cmdPool);
+        // Dropped without submission, the pool can still be recycled
+        if(frame)
+            frame->pending.fetch_sub(1, std::memory_order_release);
     }
 
-    void TrackedCommandBuffer::addImageBarrier(const TexturePtr& texture, ResourceState new_state) const
+    void TrackedCommandBuffer::close()
     {
-        ResourceState old_state = texture->state;
-        vk::ImageMemoryBarrier2KHR barrier;
-        barrier.srcAccessMask = util_to_vk_access_flags( old_state );
-        barrier.srcStageMask = util_determine_pipeline_stage_flags2( barrier.srcAccessMask, queueKind);
-        barrier.dstAccessMask = util_to_vk_access_flags( new_state );
-        barrier.dstStageMask = util_determine_pipeline_stage_flags2( barrier.dstAccessMask, queueKind);
-        barrier.oldLayout = util_to_vk_image_layout( old_state );
-        barrier.newLayout = util_to_vk_image_layout( new_state );
-        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-        barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-        barrier.setImage(texture->handle);
-        vk::ImageAspectFlags aspect = LerDevice::guessImageAspectFlags(texture->info.format, false);
-        barrier.setSubresourceRange(vk::ImageSubresourceRange(aspect, 0, VK_REMAINING_MIP_LEVELS, 0, texture->info.arrayLayers));
+        if(m_closed)
+            return;
+        m_closed = true;
+        flushBarriers();
+        cmdBuf.end();
+    }
 
-        texture->state = new_state;
-        vk::DependencyInfoKHR dependency_info;
-        dependency_info.imageMemoryBarrierCount = 1;
-        dependency_info.pImageMemoryBarriers = &barrier;
+    void TrackedCommandBuffer::markSubmitted(uint64_t id)
+    {
+        submissionID = id;
+        if(frame == nullptr)
+            return;
 
-        /*log::debug("[ImageBarrier: {}] srcStage: {}, dstStage {}, oldLayout: {}, newLayout: {}", texture->name,
-           vk::to_string(barrier.srcStageMask), vk::to_string(barrier.dstStageMask),
-           vk::to_string(barrier.oldLayout), vk::to_string(barrier.newLayout));*/
-        cmdBuf.pipelineBarrier2(dependency_info);
+        // Submission IDs grow per queue, only the submitting thread writes it
+        if(id > frame->lastSubmissionID.load(std::memory_order_relaxed))
+            frame->lastSubmissionID.store(id, std::memory_order_relaxed);
+        frame->pending.fetch_sub(1, std::memory_order_release);
+        frame = nullptr;
     }
 
-    void TrackedCommandBuffer::addBufferBarrier(const ler::BufferPtr& buffer, ler::ResourceState new_state) const
+    bool TrackedCommandBuffer::isRedundant(ResourceState old_state, ResourceState new_state)
+    {
+        // Write after write still needs a barrier, read after read with the same layout does not
+        constexpr uint32_t kWriteStates = RenderTarget | UnorderedAccess | DepthWrite | CopyDest;
+        return old_state == new_state && (new_state & kWriteStates) == 0;
+    }
+
+    void TrackedCommandBuffer::createImageBarriers(const TexturePtr& texture, ResourceState new_state, CommandQueue queue,
+                                                   std::vector<vk::ImageMemoryBarrier2>& barriers, const vk::ImageSubresourceRange& range)
+    {
+        const uint32_t mipCount = range.levelCount == VK_REMAINING_MIP_LEVELS ? texture->info.mipLevels - range.baseMipLevel : range.levelCount;
+        const uint32_t layerCount = range.layerCount == VK_REMAINING_ARRAY_LAYERS ? texture->info.arrayLayers - range.baseArrayLayer : range.layerCount;
+        const uint32_t mipEnd = range.baseMipLevel + mipCount;
+        const vk::ImageAspectFlags aspect = LerDevice::guessImageAspectFlags(texture->info.format, false);
+        const size_t first = barriers.size();
+
+        for(uint32_t layer = range.baseArrayLayer; layer < range.baseArrayLayer + layerCount; ++layer)
+        {
+            uint32_t mip = range.baseMipLevel;
+            while(mip < mipEnd)
+            {
+                // Consecutive mips sharing a state are transitioned together
+                const ResourceState old_state = texture->getState(mip, layer);
+                uint32_t count = 1;
+                while(mip + count < mipEnd && texture->getState(mip + count, layer) == old_state)
+                    ++count;
+
+                if(!isRedundant(old_state, new_state))
+                {
+                    vk::ImageMemoryBarrier2KHR barrier;
+                    barrier.srcAccessMask = util_to_vk_access_flags( old_state );
+                    barrier.srcStageMask = util_determine_pipeline_stage_flags2( barrier.srcAccessMask, queue);
+                    barrier.dstAccessMask = util_to_vk_access_flags( new_state );
+                    barrier.dstStageMask = util_determine_pipeline_stage_flags2( barrier.dstAccessMask, queue);
+                    barrier.oldLayout = util_to_vk_image_layout( old_state );
+                    barrier.newLayout = util_to_vk_image_layout( new_state );
+                    barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+                    barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+                    barrier.setImage(texture->handle);
+                    barrier.setSubresourceRange(vk::ImageSubresourceRange(aspect, mip, count, layer, 1));
+
+                    // Extend the same mip run of the previous layer
+                    auto it = std::find_if(barriers.begin() + static_cast<std::ptrdiff_t>(first), barriers.end(), [&](const vk::ImageMemoryBarrier2& b)
+                    {
+                        const auto& sub = b.subresourceRange;
+                        return sub.baseMipLevel == mip && sub.levelCount == count && sub.baseArrayLayer + sub.layerCount == layer
+                            && b.oldLayout == barrier.oldLayout && b.srcAccessMask == barrier.srcAccessMask && b.srcStageMask == barrier.srcStageMask;
+                    });
+                    if(it != barriers.end())
+                        it->subresourceRange.layerCount += 1;
+                    else
+                        barriers.emplace_back(barrier);
+                }
+                mip += count;
+            }
+        }
+
+        texture->setState(vk::ImageSubresourceRange(aspect, range.baseMipLevel, mipCount, range.baseArrayLayer, layerCount), new_state);
+        /*log::debug("[ImageBarrier: {}] {} barriers", texture->name, barriers.size() - first);*/
+    }
+
+    void TrackedCommandBuffer::createBufferBarrier(const BufferPtr& buffer, ResourceState new_state, CommandQueue queue, std::vector<vk::BufferMemoryBarrier2>& barriers)
     {
         ResourceState old_state = buffer->state;
+        buffer->state = new_state;
+        if(isRedundant(old_state, new_state))
+            return;
+
         vk::BufferMemoryBarrier2KHR barrier;
         barrier.srcAccessMask = util_to_vk_access_flags(old_state);
-        barrier.srcStageMask = util_determine_pipeline_stage_flags2(barrier.srcAccessMask, queueKind);
+        barrier.srcStageMask = util_determine_pipeline_stage_flags2(barrier.srcAccessMask, queue);
         barrier.dstAccessMask = util_to_vk_access_flags(new_state);
-        barrier.dstStageMask = util_determine_pipeline_stage_flags2(barrier.dstAccessMask, queueKind);
+        barrier.dstStageMask = util_determine_pipeline_stage_flags2(barrier.dstAccessMask, queue);
         barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
         barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
         barrier.buffer = buffer->handle;
         barrier.offset = 0;
         barrier.size = VK_WHOLE_SIZE;
-
-        vk::DependencyInfoKHR dependency_info;
-        dependency_info.bufferMemoryBarrierCount = 1;
-        dependency_info.pBufferMemoryBarriers = &barrier;
-
-        cmdBuf.pipelineBarrier2(dependency_info);
+        barriers.emplace_back(barrier);
         /*log::debug("[BufferBarrier] srcStage: {}, dstStage {}, srcMask: {}, dstMask: {}",
                    vk::to_string(barrier.srcStageMask), vk::to_string(barrier.dstStageMask),
                    vk::to_string(barrier.srcAccessMask), vk::to_string(barrier.dstAccessMask));*/
     }
 
-    void TrackedCommandBuffer::addBarrier(const std::shared_ptr<IResource>& resource, ResourceState new_state) const
+    void TrackedCommandBuffer::addBarriers(std::span<const vk::ImageMemoryBarrier2> images, std::span<const vk::BufferMemoryBarrier2> buffers)
+    {
+        m_imageBarriers.insert(m_imageBarriers.end(), images.begin(), images.end());
+        m_bufferBarriers.insert(m_bufferBarriers.end(), buffers.begin(), buffers.end());
+    }
+
+    void TrackedCommandBuffer::flushBarriers()
+    {
+        if(m_imageBarriers.empty() && m_bufferBarriers.empty())
+            return;
+
+        vk::DependencyInfoKHR dependency_info;
+        dependency_info.setImageMemoryBarriers(m_imageBarriers);
+        dependency_info.setBufferMemoryBarriers(m_bufferBarriers);
+        cmdBuf.pipelineBarrier2(dependency_info);
+        m_imageBarriers.clear();
+        m_bufferBarriers.clear();
+    }
+
+    void TrackedCommandBuffer::addImageBarrier(const TexturePtr& texture, ResourceState new_state, const vk::ImageSubresourceRange& range)
+    {
+        createImageBarriers(texture, new_state, queueKind, m_imageBarriers, range);
+    }
+
+    void TrackedCommandBuffer::addBufferBarrier(const ler::BufferPtr& buffer, ler::ResourceState new_state)
+    {
+        createBufferBarrier(buffer, new_state, queueKind, m_bufferBarriers);
+    }
+
+    void TrackedCommandBuffer::addBarrier(const std::shared_ptr<IResource>& resource, ResourceState new_state)
     {
         if(dynamic_cast<Texture*>(resource.get()))
             addImageBarrier(std::static_pointer_cast<Texture>(resource), new_state);
@@ -76,6 +162,7 @@ namespace ler
         referencedResources.emplace_back(src);
         referencedResources.emplace_back(dst);
 
+        flushBarriers();
         vk::BufferCopy copyRegion(0, dstOffset, byteSize);
         cmdBuf.copyBuffer(src->handle, dst->handle, copyRegion);
     }
@@ -86,6 +173,7 @@ namespace ler
         referencedResources.emplace_back(src);
         referencedResources.emplace_back(dst);
 
+        flushBarriers();
         cmdBuf.copyBuffer(src->handle, dst->handle, copy);
     }
 
@@ -97,6 +185,7 @@ namespace ler
 
         // prepare texture to transfer layout!
         addImageBarrier(texture, CopyDest);
+        flushBarriers();
         // Copy buffer to texture
         vk::BufferImageCopy copyRegion(0, 0, 0);
         copyRegion.imageExtent = texture->info.extent;
@@ -106,12 +195,17 @@ namespace ler
         addImageBarrier(texture, ShaderResource);
     }
 
-    void TrackedCommandBuffer::bindPipeline(const PipelinePtr& pipeline, const vk::DescriptorSet set) const
+    void TrackedCommandBuffer::bindPipeline(const PipelinePtr& pipeline, const vk::DescriptorSet set, std::span<const uint32_t> dynamicOffsets)
     {
+        // Dispatches and draws recorded on cmdBuf follow a bind
+        flushBarriers();
         cmdBuf.bindPipeline(pipeline->bindPoint, pipeline->handle.get());
         if (set)
         {
-            cmdBuf.bindDescriptorSets(pipeline->bindPoint, pipeline->pipelineLayout.get(), 0, set, nullptr);
+            std::array<uint32_t, 8> zeros = {};
+            if (dynamicOffsets.empty())
+                dynamicOffsets = std::span(zeros).first(std::min<size_t>(pipeline->getDynamicCount(0), zeros.size()));
+            cmdBuf.bindDescriptorSets(pipeline->bindPoint, pipeline->pipelineLayout.get(), 0, set, dynamicOffsets);
         }
     }
 
@@ -151,6 +245,7 @@ namespace ler
         renderInfo.setRenderArea(renderArea);
         renderInfo.setLayerCount(1);
         renderInfo.setColorAttachments(colorAttachments);
+        flushBarriers();
         cmdBuf.beginRendering(renderInfo);
         cmdBuf.setScissor(0, 1, &renderArea);
         cmdBuf.setViewport(0, 1, &viewport);
@@ -171,14 +266,16 @@ namespace ler
         if (pass.depth.imageView)
             renderInfo.setPDepthAttachment(&pass.depth);
 
+        flushBarriers();
         cmdBuf.beginRendering(renderInfo);
         cmdBuf.setScissor(0, 1, &renderArea);
         cmdBuf.setViewport(0, 1, &viewport);
         m_beginRendering = true;
     }
 
-    void TrackedCommandBuffer::draw(uint32_t vertexCount) const
+    void TrackedCommandBuffer::draw(uint32_t vertexCount)
     {
+        flushBarriers();
         cmdBuf.draw(vertexCount, 1, 0, 0);
     }
 
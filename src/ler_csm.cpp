@@ -24,7 +24,7 @@ namespace ler
         info.depthAttach = depthFormat;
         info.polygonMode = vk::PolygonMode::eFill;
         info.topology = vk::PrimitiveTopology::eTriangleList;
-        m_pipeline = device->createGraphicsPipeline(shaders, info);
+        m_pipeline = device->createGraphicsPipelineAsync(shaders, info);
         m_descriptor = m_pipeline->createDescriptorSet(0);
     }
 
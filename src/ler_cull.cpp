@@ -4,33 +4,81 @@
 
 #include "ler_cull.hpp"
 
+#include <bit>
+
 namespace ler
 {
+    u32 divideRoundingUp(u32 dividend, u32 divisor)
+    {
+        return (dividend + divisor - 1) / divisor;
+    }
+
     void InstanceCull::init(const LerDevicePtr& device, const std::array<BufferPtr, 2>& buffers)
     {
         using bu = vk::BufferUsageFlagBits;
-        m_visibleBuffer = device->createBuffer(256, bu::eStorageBuffer | bu::eIndirectBuffer, true);
-        m_frustumBuffer = device->createBuffer(256, bu::eUniformBuffer, true);
+        for(uint32_t i = 0; i < kMaxFramesInFlight; ++i)
+            m_visibleBuffers[i] = device->createBuffer(256, bu::eStorageBuffer | bu::eIndirectBuffer, true);
+        m_upload = device->getUploadAllocator();
         m_commandBuffer = device->createBuffer(C16Mio, bu::eStorageBuffer | bu::eIndirectBuffer);
 
         m_reductionSampler = device->createSamplerMipMap(vk::SamplerAddressMode::eClampToEdge, true, f32(m_mipLevels), true);
         m_depthPyramid = device->createTexture(vk::Format::eR16Sfloat, vk::Extent2D(2048, 2048), vk::SampleCountFlagBits::e1, true, 1, m_mipLevels);
 
-        ler::ShaderPtr shader = device->createShader("generate_draws.comp.spv");
-        m_pipeline = device->createComputePipeline(shader);
-        m_descriptor = m_pipeline->createDescriptorSet(0);
+        // Cull pipelines bake the render extent, they are built on the first resize
+        m_buffers = buffers;
+        if(!device->getVulkanContext().fullSubgroups)
+            log::warn("InstanceCull: full subgroups not guaranteed, compaction may drop draws on partial subgroups");
 
-        device->updateStorage(m_descriptor, 0, m_frustumBuffer, 256, true);
-        device->updateStorage(m_descriptor, 1, buffers[0], VK_WHOLE_SIZE); // Instance
-        device->updateStorage(m_descriptor, 2, buffers[1], VK_WHOLE_SIZE); // Meshlet
-        device->updateStorage(m_descriptor, 3, m_commandBuffer, VK_WHOLE_SIZE);
-        device->updateStorage(m_descriptor, 4, m_visibleBuffer, 256);
-
-        shader = device->createShader("downsample.comp.spv");
+        ler::ShaderPtr shader = device->createShader("downsample.comp.spv");
         m_pyramid = device->createComputePipeline(shader);
 
-        for(auto & m_slot : m_slots)
-            m_slot = m_pyramid->createDescriptorSet(0);
+        for(auto& slots : m_slots)
+        {
+            for(auto& slot : slots)
+                slot = m_pyramid->createDescriptorSet(0);
+        }
+    }
+
+    void InstanceCull::createCullPipelines(const LerDevicePtr& device, vk::Extent2D extent)
+    {
+        // Fold pyramid size, resolution and workgroup size into the shader
+        SpecConstants constants;
+        constants[0] = device->getVulkanContext().subgroupSize;
+        constants[1] = std::bit_cast<uint32_t>(f32(m_hzbSize));
+        constants[2] = VK_TRUE;
+        constants[5] = std::bit_cast<uint32_t>(f32(extent.width));
+        constants[6] = std::bit_cast<uint32_t>(f32(extent.height));
+        m_groupSize = constants[0];
+
+        PipelinePtr pipeline = device->createComputePipeline(device->createShader("generate_draws.comp.spv"), constants, true);
+        constants[2] = VK_FALSE;
+        PipelinePtr prePassPipeline = device->createComputePipeline(device->createShader("generate_draws.comp.spv"), constants, true);
+        if(m_prePassPipeline && prePassPipeline != m_prePassPipeline)
+            device->release(m_prePassPipeline);
+        m_prePassPipeline = prePassPipeline;
+        if(pipeline == m_pipeline)
+            return;
+
+        // Both variants share the same set layout, so one descriptor per frame serves both
+        if(m_pipeline)
+        {
+            // The variant may be shared or revived, give its sets back
+            for(vk::DescriptorSet descriptor : m_descriptors)
+                device->release(m_pipeline, descriptor);
+            device->release(m_pipeline);
+        }
+        m_pipeline = pipeline;
+        m_sourceViews = {};
+        for(uint32_t i = 0; i < kMaxFramesInFlight; ++i)
+        {
+            vk::DescriptorSet descriptor = m_pipeline->createDescriptorSet(0);
+            m_pipeline->updateStorage(descriptor, 0, m_upload->getBuffer(), sizeof(Frustum)); // Dynamic offset
+            device->updateStorage(descriptor, 1, m_buffers[0], VK_WHOLE_SIZE); // Instance
+            device->updateStorage(descriptor, 2, m_buffers[1], VK_WHOLE_SIZE); // Meshlet
+            device->updateStorage(descriptor, 3, m_commandBuffer, VK_WHOLE_SIZE);
+            device->updateStorage(descriptor, 4, m_visibleBuffers[i], 256);
+            m_descriptors[i] = descriptor;
+        }
     }
 
     void InstanceCull::createDepthPyramid(const LerDevicePtr& device, vk::Extent2D extent)
@@ -38,26 +86,40 @@ namespace ler
         u32 size = glm::max(extent.width, extent.height);
         m_hzbSize = glm::ceilPowerOfTwo(size);
         m_mipLevels = glm::log2(size) + 1u;
+        m_sourceViews = {};
+        createCullPipelines(device, extent);
 
+        // Frames in flight may still sample the previous pyramid
+        if(m_depthPyramid)
+            device->release(m_depthPyramid);
+        if(m_reductionSampler)
+            device->release(std::make_shared<vk::UniqueSampler>(std::move(m_reductionSampler)));
         m_reductionSampler = device->createSamplerMipMap(vk::SamplerAddressMode::eClampToEdge, true, f32(m_mipLevels), true);
         m_depthPyramid = device->createTexture(vk::Format::eR16Sfloat, vk::Extent2D(m_hzbSize, m_hzbSize), vk::SampleCountFlagBits::e1, true, 1, m_mipLevels);
-        device->initTextureLayout(m_depthPyramid, vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead);
+        device->initTextureLayout(m_depthPyramid, vk::ImageLayout::eReadOnlyOptimal, vk::AccessFlagBits::eShaderRead);
+        m_depthPyramid->state = ShaderResource;
     }
 
     void InstanceCull::updateDescriptors(const TexturePtr& depth)
     {
+        // Frames in flight still read their own sets, only the retired slot follows the new views
+        if(depth->view() == m_sourceViews[m_frameIndex])
+            return;
+        m_sourceViews[m_frameIndex] = depth->view();
+
         vk::Sampler sampler = m_reductionSampler.get();
+        std::array<vk::DescriptorSet,16>& slots = m_slots[m_frameIndex];
         for(uint32_t mipIndex = 0; mipIndex < m_mipLevels; ++mipIndex)
         {
             m_views[mipIndex] = m_depthPyramid->view(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, mipIndex, 1, 0, 1));
             vk::ImageView imageDst = m_views[mipIndex];
             vk::ImageView imageSrc = mipIndex == 0 ? depth->view() : m_views[mipIndex - 1u];
-            m_pyramid->updateSampler(m_slots[mipIndex], 1, sampler, vk::ImageLayout::eGeneral, imageDst);
-            m_pyramid->updateSampler(m_slots[mipIndex], 0, sampler, vk::ImageLayout::eShaderReadOnlyOptimal, imageSrc);
+            m_pyramid->updateSampler(slots[mipIndex], 1, sampler, vk::ImageLayout::eGeneral, imageDst);
+            m_pyramid->updateSampler(slots[mipIndex], 0, sampler, mipIndex == 0 ? vk::ImageLayout::eShaderReadOnlyOptimal : vk::ImageLayout::eReadOnlyOptimal, imageSrc);
         }
 
         vk::ImageView view = m_depthPyramid->view(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, m_mipLevels, 0, 1));
-        m_pipeline->updateSampler(m_descriptor, 5,  m_reductionSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal, view);
+        m_pipeline->updateSampler(m_descriptors[m_frameIndex], 5, m_reductionSampler.get(), vk::ImageLayout::eReadOnlyOptimal, view);
     }
 
     void InstanceCull::dispatch(const CommandPtr& cmd, const CameraParam& camera, uint32_t instanceCount, bool prePass)
@@ -65,51 +127,72 @@ namespace ler
         m_frustum.cull = prePass ? 0 : 42;
         m_frustum.num = instanceCount;
         m_frustum.camera = camera.test;
-        m_visibleBuffer->getUint(&drawCount);
+        // Slot retired by the frame throttle, holds the count of its last use
+        const BufferPtr& visibleBuffer = m_visibleBuffers[m_frameIndex];
+        visibleBuffer->getUint(&drawCount);
         LerDevice::getFrustumPlanes(camera.proj * camera.view, m_frustum.planes);
         LerDevice::getFrustumCorners(camera.proj * camera.view, m_frustum.corners);
-        static constexpr uint32_t resetNum = 0;
-        m_visibleBuffer->uploadFromMemory(&resetNum, sizeof(uint32_t));
-        m_frustumBuffer->uploadFromMemory(&m_frustum, sizeof(Frustum));
-
-        cmd->bindPipeline(m_pipeline, m_descriptor);
-        cmd->cmdBuf.pushConstants(m_pipeline->pipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, 128, &camera);
-        cmd->cmdBuf.dispatch(1 + m_frustum.num / 64, 1, 1);
-
-        using ps = vk::PipelineStageFlagBits;
-        std::vector<vk::BufferMemoryBarrier> bufferBarriers;
-        bufferBarriers.emplace_back(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eMemoryRead, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_commandBuffer->handle, 0, VK_WHOLE_SIZE);
-        bufferBarriers.emplace_back(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eMemoryRead, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_visibleBuffer->handle, 0, VK_WHOLE_SIZE);
-        cmd->cmdBuf.pipelineBarrier(ps::eComputeShader, ps::eDrawIndirect, vk::DependencyFlags(), {}, bufferBarriers, {});
-    }
+        // Pre-pass and main pass of a frame each get their own copy
+        UploadAllocation frustum = m_upload->upload(m_frustum);
+        if(!frustum)
+            return;
 
-    u32 divideRoundingUp(u32 dividend, u32 divisor)
-    {
-        return (dividend + divisor - 1) / divisor;
+        // Previous frame may still draw from the shared command buffer, on the compute queue the graphics wait covers it
+        using ps = vk::PipelineStageFlagBits2;
+        using ac = vk::AccessFlagBits2;
+        const bool async = cmd->queueKind == CommandQueue::Compute;
+        std::array<vk::BufferMemoryBarrier2, 2> bufferBarriers;
+        bufferBarriers[0].setBuffer(m_commandBuffer->handle).setSize(VK_WHOLE_SIZE);
+        bufferBarriers[0].setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED).setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        bufferBarriers[1] = bufferBarriers[0];
+        bufferBarriers[1].setBuffer(visibleBuffer->handle);
+        if(!async)
+        {
+            bufferBarriers[0].setSrcStageMask(ps::eDrawIndirect | ps::eVertexShader).setDstStageMask(ps::eComputeShader).setDstAccessMask(ac::eShaderWrite);
+            cmd->addBarriers({}, std::span(bufferBarriers).first(1));
+        }
+
+        // Pre-pass and main pass share the count, reset it on the GPU once the previous pass is consumed
+        vk::BufferMemoryBarrier2 resetBarrier = bufferBarriers[1];
+        resetBarrier.setSrcStageMask(async ? ps::eComputeShader : ps::eDrawIndirect | ps::eComputeShader);
+        resetBarrier.setSrcAccessMask(ac::eShaderWrite).setDstStageMask(ps::eTransfer).setDstAccessMask(ac::eTransferWrite);
+        cmd->addBarriers({}, std::span(&resetBarrier, 1));
+        cmd->flushBarriers();
+        cmd->cmdBuf.fillBuffer(visibleBuffer->handle, 0, sizeof(uint32_t), 0);
+        resetBarrier.setSrcStageMask(ps::eTransfer).setSrcAccessMask(ac::eTransferWrite);
+        resetBarrier.setDstStageMask(ps::eComputeShader).setDstAccessMask(ac::eShaderRead | ac::eShaderWrite);
+        cmd->addBarriers({}, std::span(&resetBarrier, 1));
+
+        const PipelinePtr& pipeline = prePass ? m_prePassPipeline : m_pipeline;
+        cmd->bindPipeline(pipeline, m_descriptors[m_frameIndex], std::span(&frustum.offset, 1));
+        cmd->cmdBuf.pushConstants(pipeline->pipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, 128, &camera);
+        cmd->cmdBuf.dispatch(divideRoundingUp(m_frustum.num, m_groupSize), 1, 1);
+        if(async)
+            return;
+
+        // Recorded with the next pass barriers
+        for(vk::BufferMemoryBarrier2& barrier : bufferBarriers)
+        {
+            barrier.setSrcStageMask(ps::eComputeShader).setSrcAccessMask(ac::eShaderWrite);
+            barrier.setDstStageMask(ps::eDrawIndirect).setDstAccessMask(ac::eMemoryRead);
+        }
+        cmd->addBarriers({}, bufferBarriers);
     }
 
     void InstanceCull::renderDepthPyramid(const TexturePtr& depth, const CommandPtr& cmd)
     {
         updateDescriptors(depth);
 
-        using ps = vk::PipelineStageFlagBits;
-        std::vector<vk::ImageMemoryBarrier> imageBarriers;
-        auto& barrier = imageBarriers.emplace_back();
-        barrier.setImage(depth->handle);
-        barrier.setOldLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
-        barrier.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
-        barrier.setSrcAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite);
-        barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-        barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-        barrier.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1));
-        cmd->cmdBuf.pipelineBarrier(ps::eEarlyFragmentTests, ps::eComputeShader, vk::DependencyFlags(), {}, {}, imageBarriers);
+        // Graphics stages are not allowed on the compute queue, the caller transitions the depth
+        const bool async = cmd->queueKind == CommandQueue::Compute;
+        if(!async)
+            releaseDepth(depth, cmd);
 
         beginBarrier(cmd);
         for (u32 mipIndex = 0; mipIndex < m_mipLevels; ++mipIndex)
         {
             u32 hzbMipSize = m_hzbSize >> mipIndex;
-            cmd->bindPipeline(m_pyramid, m_slots[mipIndex]);
+            cmd->bindPipeline(m_pyramid, m_slots[m_frameIndex][mipIndex]);
             glm::uvec2 groupCount(divideRoundingUp(hzbMipSize, 32u));
             cmd->cmdBuf.pushConstants(m_pyramid->pipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(u32), &hzbMipSize);
             cmd->cmdBuf.dispatch(groupCount.x, groupCount.y, 1);
@@ -117,66 +200,62 @@ namespace ler
             endBarrier(cmd, mipIndex);
         }
 
-        imageBarriers.clear();
-        barrier = imageBarriers.emplace_back();
-        barrier.setImage(depth->handle);
-        barrier.setOldLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
-        barrier.setNewLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
-        barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderRead);
-        barrier.setDstAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite);
+        if(!async)
+            acquireDepth(depth, cmd);
+    }
+
+    static vk::ImageMemoryBarrier2 createLayoutBarrier(const TexturePtr& texture, const vk::ImageSubresourceRange& range, vk::ImageLayout oldLayout, vk::ImageLayout newLayout)
+    {
+        vk::ImageMemoryBarrier2 barrier;
+        barrier.setImage(texture->handle);
+        barrier.setOldLayout(oldLayout);
+        barrier.setNewLayout(newLayout);
         barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
         barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-        barrier.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1));
-        cmd->cmdBuf.pipelineBarrier(ps::eComputeShader, ps::eEarlyFragmentTests, vk::DependencyFlags(), {}, {}, imageBarriers);
+        barrier.setSubresourceRange(range);
+        return barrier;
+    }
 
+    void InstanceCull::releaseDepth(const TexturePtr& depth, const CommandPtr& cmd)
+    {
+        using ps = vk::PipelineStageFlagBits2;
+        using ac = vk::AccessFlagBits2;
+        auto barrier = createLayoutBarrier(depth, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1),
+                                           vk::ImageLayout::eDepthStencilAttachmentOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+        barrier.setSrcStageMask(ps::eEarlyFragmentTests | ps::eLateFragmentTests);
+        barrier.setSrcAccessMask(ac::eDepthStencilAttachmentWrite);
+        barrier.setDstStageMask(ps::eComputeShader);
+        barrier.setDstAccessMask(ac::eShaderRead);
+        cmd->addBarriers(std::span(&barrier, 1), {});
     }
 
-    void InstanceCull::beginBarrier(const CommandPtr& cmd)
+    void InstanceCull::acquireDepth(const TexturePtr& depth, const CommandPtr& cmd)
     {
-        using ps = vk::PipelineStageFlagBits;
-        std::vector<vk::ImageMemoryBarrier> imageBarriers;
-        auto& barrier = imageBarriers.emplace_back();
-        barrier.setImage(m_depthPyramid->handle);
-        barrier.setOldLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
-        barrier.setNewLayout(vk::ImageLayout::eGeneral);
-        barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderRead);
-        barrier.setDstAccessMask(vk::AccessFlagBits::eShaderWrite);
-        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-        barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-        barrier.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, m_mipLevels, 0, 1));
-        cmd->cmdBuf.pipelineBarrier(ps::eComputeShader, ps::eComputeShader, vk::DependencyFlags(), {}, {}, imageBarriers);
+        using ps = vk::PipelineStageFlagBits2;
+        using ac = vk::AccessFlagBits2;
+        auto barrier = createLayoutBarrier(depth, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1),
+                                           vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+        barrier.setSrcStageMask(ps::eComputeShader);
+        barrier.setSrcAccessMask(ac::eShaderRead);
+        barrier.setDstStageMask(ps::eEarlyFragmentTests);
+        barrier.setDstAccessMask(ac::eDepthStencilAttachmentWrite);
+        cmd->addBarriers(std::span(&barrier, 1), {});
     }
 
+    void InstanceCull::beginBarrier(const CommandPtr& cmd)
+    {
+        cmd->addImageBarrier(m_depthPyramid, UnorderedAccess);
+    }
 
     void InstanceCull::endBarrier(const CommandPtr& cmd, uint32_t mipLevel)
     {
-        using ps = vk::PipelineStageFlagBits;
-        std::vector<vk::ImageMemoryBarrier> imageBarriers;
-        auto& barrier = imageBarriers.emplace_back();
-        barrier.setImage(m_depthPyramid->handle);
-        barrier.setOldLayout(vk::ImageLayout::eGeneral);
-        barrier.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
-        barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
-        barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-        barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-        barrier.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, mipLevel, 1, 0, 1));
-        cmd->cmdBuf.pipelineBarrier(ps::eComputeShader, ps::eComputeShader, vk::DependencyFlags(), {}, {}, imageBarriers);
+        // Only the written mip becomes readable, the next dispatch samples it
+        cmd->addImageBarrier(m_depthPyramid, ShaderResource, vk::ImageSubresourceRange({}, mipLevel, 1, 0, 1));
     }
 
     void InstanceCull::addLayoutPyramid(const CommandPtr& cmd)
     {
-        using ps = vk::PipelineStageFlagBits;
-        std::vector<vk::ImageMemoryBarrier> imageBarriers;
-        auto& barrier = imageBarriers.emplace_back();
-        barrier.setImage(m_depthPyramid->handle);
-        barrier.setOldLayout(vk::ImageLayout::eUndefined);
-        barrier.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
-        barrier.setSrcAccessMask(vk::AccessFlagBits::eNone);
-        barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-        barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-        barrier.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, m_mipLevels, 0, 1));
-        cmd->cmdBuf.pipelineBarrier(ps::eAllCommands, ps::eAllCommands, vk::DependencyFlags(), {}, {}, imageBarriers);
+        m_depthPyramid->setState(TrackedCommandBuffer::AllSub, Undefined);
+        cmd->addImageBarrier(m_depthPyramid, ShaderResource);
     }
-}
\ No newline at end of file
+}
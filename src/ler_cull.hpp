@@ -17,28 +17,40 @@ namespace ler
         void dispatch(const CommandPtr& cmd, const CameraParam& camera, uint32_t instanceCount, bool prePass);
         void createDepthPyramid(const LerDevicePtr& device, vk::Extent2D extent);
         void renderDepthPyramid(const TexturePtr& depth, const CommandPtr& cmd);
+        void releaseDepth(const TexturePtr& depth, const CommandPtr& cmd);
+        void acquireDepth(const TexturePtr& depth, const CommandPtr& cmd);
         void updateDescriptors(const TexturePtr& depth);
+        void setFrameIndex(uint32_t frameIndex) { m_frameIndex = frameIndex; }
 
-        [[nodiscard]] const BufferPtr& getCountBuffer() const { return m_visibleBuffer; }
+        [[nodiscard]] const BufferPtr& getCountBuffer() const { return m_visibleBuffers[m_frameIndex]; }
         [[nodiscard]] const BufferPtr& getCommandBuffers() const { return m_commandBuffer; }
         uint32_t drawCount;
 
     private:
 
+        void createCullPipelines(const LerDevicePtr& device, vk::Extent2D extent);
+
         Frustum m_frustum;
         PipelinePtr m_pipeline;
-        BufferPtr m_frustumBuffer;
-        BufferPtr m_visibleBuffer;
+        PipelinePtr m_prePassPipeline;
+        std::array<BufferPtr, 2> m_buffers;
+        u32 m_groupSize = 64u;
+        u32 m_frameIndex = 0;
+        UploadAllocatorPtr m_upload;
+        // Reset on the GPU before each pass, read back by the host once the slot is retired
+        std::array<BufferPtr, kMaxFramesInFlight> m_visibleBuffers;
+        std::array<vk::DescriptorSet, kMaxFramesInFlight> m_descriptors;
         BufferPtr m_commandBuffer;
-        vk::DescriptorSet m_descriptor;
 
         u32 m_hzbSize = 2048u;
         u32 m_mipLevels = 11u;
         PipelinePtr m_pyramid;
         TexturePtr m_depthPyramid;
         std::array<vk::ImageView,16> m_views;
+        // Sets of a frame slot are only rewritten once it is retired
+        std::array<vk::ImageView, kMaxFramesInFlight> m_sourceViews = {};
         vk::UniqueSampler m_reductionSampler;
-        std::array<vk::DescriptorSet,16> m_slots;
+        std::array<std::array<vk::DescriptorSet,16>, kMaxFramesInFlight> m_slots;
 
         void beginBarrier(const CommandPtr& cmd);
         void endBarrier(const CommandPtr& cmd, uint32_t mipLevel);
@@ -3,6 +3,7 @@
 //
 
 #include "ler_dev.hpp"
+#include "ler_cache.hpp"
 
 #define SPIRV_REFLECT_HAS_VULKAN_H
 #include <spirv_reflect.h>
@@ -34,13 +35,33 @@ namespace ler
         m_queues[int(CommandQueue::Transfer)] = std::make_unique<Queue>(m_context, CommandQueue::Transfer,
                                                                         context.transferQueueFamily);
 
+        // Resources are shared with the async compute queue without ownership transfers,
+        // the transfer queue uploads into the same resources so it joins the list
+        if(context.computeQueueFamily != UINT32_MAX)
+        {
+            m_queues[int(CommandQueue::Compute)] = std::make_unique<Queue>(m_context, CommandQueue::Compute,
+                                                                           context.computeQueueFamily);
+            m_sharedQueueFamilies = {context.graphicsQueueFamily, context.computeQueueFamily};
+            if(context.transferQueueFamily != context.graphicsQueueFamily && context.transferQueueFamily != context.computeQueueFamily)
+                m_sharedQueueFamilies.emplace_back(context.transferQueueFamily);
+        }
+
         m_texturePools.emplace_back(std::make_shared<TexturePool>());
         m_texturePools.back()->init(this);
+
+        m_uploadAllocator = std::make_shared<UploadAllocator>();
+        m_uploadAllocator->init(this);
     }
 
     LerDevice::~LerDevice()
     {
-
+        // Pending compilations still reference the device
+        std::lock_guard lock(m_pipelineMutex);
+        for(const auto& weak : m_pipelines)
+        {
+            if(PipelinePtr pipeline = weak.lock())
+                pipeline->wait();
+        }
     }
 
     vk::AccessFlags2 util_to_vk_access_flags(ResourceState state)
@@ -201,14 +222,35 @@ namespace ler
         buffer->info.setSize(byteSize);
         buffer->info.setUsage(usageFlags);
         buffer->info.setSharingMode(vk::SharingMode::eExclusive);
+        if(hasAsyncCompute())
+            buffer->info.setSharingMode(vk::SharingMode::eConcurrent).setQueueFamilyIndices(m_sharedQueueFamilies);
 
         buffer->allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
         buffer->allocInfo.flags = staging ? VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
                                             VMA_ALLOCATION_CREATE_MAPPED_BIT
-                                          : VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
-
-        vmaCreateBuffer(m_context.allocator, reinterpret_cast<VkBufferCreateInfo*>(&buffer->info), &buffer->allocInfo,
-                        reinterpret_cast<VkBuffer*>(&buffer->handle), &buffer->allocation, &buffer->hostInfo);
+                                          : 0;
+        // Large staging buffers are short-lived, they stay out of the persistent pools.
+        // Small shader buffers get their own pool, geometry keeps vertex, index and indirect data
+        using bu = vk::BufferUsageFlagBits;
+        const bool geometry = bool(usages & (bu::eVertexBuffer | bu::eIndexBuffer | bu::eIndirectBuffer));
+        const bool shader = bool(usages & (bu::eUniformBuffer | bu::eStorageBuffer));
+        if(!staging && !geometry && shader && byteSize <= kSmallBufferSize)
+            buffer->allocInfo.pool = m_context.memoryPools[MemoryClass_Storage];
+        else if(!staging)
+            buffer->allocInfo.pool = m_context.memoryPools[MemoryClass_Geometry];
+        else if(byteSize <= kSmallBufferSize)
+            buffer->allocInfo.pool = m_context.memoryPools[MemoryClass_Constant];
+
+        VkResult res = vmaCreateBuffer(m_context.allocator, reinterpret_cast<VkBufferCreateInfo*>(&buffer->info), &buffer->allocInfo,
+                                       reinterpret_cast<VkBuffer*>(&buffer->handle), &buffer->allocation, &buffer->hostInfo);
+        if(res != VK_SUCCESS && buffer->allocInfo.pool)
+        {
+            buffer->allocInfo.pool = nullptr;
+            res = vmaCreateBuffer(m_context.allocator, reinterpret_cast<VkBufferCreateInfo*>(&buffer->info), &buffer->allocInfo,
+                                  reinterpret_cast<VkBuffer*>(&buffer->handle), &buffer->allocation, &buffer->hostInfo);
+        }
+        if(res != VK_SUCCESS)
+            log::exit("Failed to allocate buffer");
 
         return buffer;
     }
@@ -223,12 +265,22 @@ namespace ler
         buffer->info.setSize(byteSize);
         buffer->info.setUsage(usageFlags);
         buffer->info.setSharingMode(vk::SharingMode::eExclusive);
+        if(hasAsyncCompute())
+            buffer->info.setSharingMode(vk::SharingMode::eConcurrent).setQueueFamilyIndices(m_sharedQueueFamilies);
 
         buffer->allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
-        buffer->allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+        buffer->allocInfo.pool = m_context.memoryPools[MemoryClass_Geometry];
 
-        vmaCreateBufferWithAlignment(m_context.allocator, reinterpret_cast<VkBufferCreateInfo*>(&buffer->info), &buffer->allocInfo,
+        VkResult res = vmaCreateBufferWithAlignment(m_context.allocator, reinterpret_cast<VkBufferCreateInfo*>(&buffer->info), &buffer->allocInfo,
+                        minAlignment, reinterpret_cast<VkBuffer*>(&buffer->handle), &buffer->allocation, &buffer->hostInfo);
+        if(res != VK_SUCCESS && buffer->allocInfo.pool)
+        {
+            buffer->allocInfo.pool = nullptr;
+            res = vmaCreateBufferWithAlignment(m_context.allocator, reinterpret_cast<VkBufferCreateInfo*>(&buffer->info), &buffer->allocInfo,
                         minAlignment, reinterpret_cast<VkBuffer*>(&buffer->handle), &buffer->allocation, &buffer->hostInfo);
+        }
+        if(res != VK_SUCCESS)
+            log::exit("Failed to allocate buffer");
 
         return buffer;
     }
@@ -399,11 +451,41 @@ namespace ler
         return {info.extent.width, info.extent.height};
     }
 
+    ResourceState Texture::getState(uint32_t mipLevel, uint32_t arrayLayer) const
+    {
+        if(m_states.empty())
+            return state;
+        return m_states[arrayLayer * info.mipLevels + mipLevel];
+    }
+
+    void Texture::setState(const vk::ImageSubresourceRange& range, ResourceState newState)
+    {
+        // Allocated on the first partial transition, whole transitions keep a single state
+        const uint32_t mipCount = range.levelCount == VK_REMAINING_MIP_LEVELS ? info.mipLevels - range.baseMipLevel : range.levelCount;
+        const uint32_t layerCount = range.layerCount == VK_REMAINING_ARRAY_LAYERS ? info.arrayLayers - range.baseArrayLayer : range.layerCount;
+        if(mipCount == info.mipLevels && layerCount == info.arrayLayers)
+            m_states.clear();
+        else if(m_states.empty())
+            m_states.assign(info.mipLevels * info.arrayLayers, state);
+
+        state = newState;
+        if(m_states.empty())
+            return;
+        for(uint32_t layer = range.baseArrayLayer; layer < range.baseArrayLayer + layerCount; ++layer)
+            std::fill_n(m_states.begin() + layer * info.mipLevels + range.baseMipLevel, mipCount, newState);
+    }
+
     void LerDevice::populateTexture(const TexturePtr& texture, vk::Format format, const vk::Extent2D& extent,
                                     vk::SampleCountFlagBits sampleCount, bool isRenderTarget, uint32_t arrayLayers, uint32_t mipLevels)
     {
+        // Only large render targets get their own memory, the rest is sub-allocated from pools
+        const uint64_t byteSize = uint64_t(extent.width) * extent.height * formatSize(static_cast<VkFormat>(format)) * arrayLayers * uint32_t(sampleCount);
+        texture->allocInfo = {};
         texture->allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
-        texture->allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+        if(isRenderTarget && byteSize >= kDedicatedTargetSize)
+            texture->allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+        else
+            texture->allocInfo.pool = m_context.memoryPools[isRenderTarget ? MemoryClass_RenderTarget : MemoryClass_Texture];
 
         texture->info = vk::ImageCreateInfo();
         texture->info.setImageType(vk::ImageType::e2D);
@@ -414,12 +496,23 @@ namespace ler
         texture->info.setInitialLayout(vk::ImageLayout::eUndefined);
         texture->info.setUsage(pickImageUsage(format, isRenderTarget));
         texture->info.setSharingMode(vk::SharingMode::eExclusive);
+        if(isRenderTarget && hasAsyncCompute())
+            texture->info.setSharingMode(vk::SharingMode::eConcurrent).setQueueFamilyIndices(m_sharedQueueFamilies);
         texture->info.setSamples(sampleCount);
         texture->info.setFlags({});
         texture->info.setTiling(vk::ImageTiling::eOptimal);
 
-        vmaCreateImage(m_context.allocator, reinterpret_cast<VkImageCreateInfo*>(&texture->info), &texture->allocInfo,
-                       reinterpret_cast<VkImage*>(&texture->handle), &texture->allocation, nullptr);
+        // A pool pins one memory type, some formats may require another
+        VkResult res = vmaCreateImage(m_context.allocator, reinterpret_cast<VkImageCreateInfo*>(&texture->info), &texture->allocInfo,
+                                      reinterpret_cast<VkImage*>(&texture->handle), &texture->allocation, nullptr);
+        if(res != VK_SUCCESS && texture->allocInfo.pool)
+        {
+            texture->allocInfo.pool = nullptr;
+            res = vmaCreateImage(m_context.allocator, reinterpret_cast<VkImageCreateInfo*>(&texture->info), &texture->allocInfo,
+                                 reinterpret_cast<VkImage*>(&texture->handle), &texture->allocation, nullptr);
+        }
+        if(res != VK_SUCCESS)
+            log::exit("Failed to allocate texture");
     }
 
     TexturePtr
@@ -464,9 +557,10 @@ namespace ler
         vk::ImageAspectFlags aspect = guessImageAspectFlags(texture->info.format, false);
         barrier.setSubresourceRange(vk::ImageSubresourceRange(aspect, 0, texture->info.mipLevels, 0, texture->info.arrayLayers));
 
+        // Later work on the graphics queue is ordered after the transition, no need to wait for it
         auto cmd = createCommand();
         cmd->cmdBuf.pipelineBarrier(ps::eAllCommands, ps::eAllCommands, vk::DependencyFlags(), {}, {}, imageBarriers);
-        submitAndWait(cmd);
+        submitCommand(cmd);
     }
 
     void RenderTarget::reset(const std::span<TexturePtr>& textures)
@@ -552,9 +646,36 @@ namespace ler
     }
 
     ShaderPtr LerDevice::createShader(const fs::path& path) const
+    {
+        // Shaders are immutable once reflected, a path is only read again when its content changed
+        auto& service = FileSystemService::Get();
+        const std::string name = path.generic_string();
+        const fs::file_time_type time = service.last_write_time(FsTag_Shaders, path);
+        {
+            std::lock_guard lock(m_shaderMutex);
+            auto it = m_shaders.find(name);
+            if(it != m_shaders.end() && it->second.time == time)
+            {
+                if(ShaderPtr cached = it->second.shader.lock())
+                    return cached;
+            }
+        }
+
+        auto bytecode = service.readFile(FsTag_Shaders, path);
+        const uint64_t checksum = CacheKey().add(bytecode).get();
+        std::lock_guard lock(m_shaderMutex);
+        ShaderEntry& entry = m_shaders[name];
+        ShaderPtr shader = entry.shader.lock();
+        if(shader == nullptr || entry.checksum != checksum)
+            shader = reflectShader(path, bytecode);
+        entry = {time, checksum, shader};
+        return shader;
+    }
+
+    ShaderPtr LerDevice::reflectShader(const fs::path& path, const Blob& bytecode) const
     {
         auto shader = std::make_shared<Shader>();
-        auto bytecode = FileSystemService::Get().readFile(FsTag_Cache, path);
+        shader->name = path.generic_string();
         vk::ShaderModuleCreateInfo shaderInfo;
         shaderInfo.setCodeSize(bytecode.size());
         shaderInfo.setPCode(reinterpret_cast<const uint32_t*>(bytecode.data()));
@@ -672,21 +793,52 @@ namespace ler
         return shader;
     }
 
-    void BasePipeline::reflectPipelineLayout(vk::Device device, const std::span<ShaderPtr>& shaders)
+    // Sets per pool, shared pipelines allocate one set per user and per frame in flight
+    static constexpr uint32_t kDescriptorPoolSets = 4 * kMaxFramesInFlight;
+
+    static vk::UniqueDescriptorPool createDescriptorPool(vk::Device device, const DescriptorAllocator& allocator)
+    {
+        vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+        descriptorPoolInfo.setPoolSizes(allocator.poolSizes);
+        descriptorPoolInfo.setFlags(allocator.poolFlags);
+        descriptorPoolInfo.setMaxSets(kDescriptorPoolSets);
+        return device.createDescriptorPoolUnique(descriptorPoolInfo);
+    }
+
+    void BasePipeline::reflectPipelineLayout(vk::Device device, const std::span<ShaderPtr>& shaders, uint32_t textureCount)
     {
         // PIPELINE LAYOUT STATE
         auto layoutInfo = vk::PipelineLayoutCreateInfo();
-        std::vector<vk::PushConstantRange> pushConstants;
+        // Stages sharing a block share one range, kept on the pipeline for layout compatibility checks
+        pushConstants.clear();
         for (auto& shader: shaders)
-            pushConstants.insert(pushConstants.end(), shader->pushConstants.begin(), shader->pushConstants.end());
+        {
+            for (const vk::PushConstantRange& range : shader->pushConstants)
+            {
+                auto it = std::ranges::find_if(pushConstants, [&](const vk::PushConstantRange& r){ return r.offset == range.offset && r.size == range.size; });
+                if (it != pushConstants.end())
+                    it->stageFlags |= range.stageFlags;
+                else
+                    pushConstants.emplace_back(range);
+            }
+        }
         layoutInfo.setPushConstantRanges(pushConstants);
 
         // SHADER REFLECT
         std::set<uint32_t> sets;
-        std::vector<vk::DescriptorPoolSize> descriptorPoolSizeInfo;
         std::multimap<uint32_t, DescriptorSetLayoutData> mergedDesc;
         for (auto& shader: shaders)
-            mergedDesc.merge(shader->descriptorMap);
+            mergedDesc.insert(shader->descriptorMap.begin(), shader->descriptorMap.end());
+
+        // Unsized sampler arrays (bindless) take the count requested by the pipeline
+        for (auto& e: mergedDesc)
+        {
+            for (auto& bind: e.second.bindings)
+                if (bind.descriptorCount == 0 &&
+                    bind.descriptorType == vk::DescriptorType::eCombinedImageSampler &&
+                    bind.stageFlags == vk::ShaderStageFlagBits::eFragment)
+                    bind.descriptorCount = textureCount;
+        }
 
         for (auto& e: mergedDesc)
             sets.insert(e.first);
@@ -695,32 +847,44 @@ namespace ler
         setLayouts.reserve(sets.size());
         for (auto& set: sets)
         {
-            descriptorPoolSizeInfo.clear();
             auto it = descriptorAllocMap.emplace(set, DescriptorAllocator());
             auto& allocator = std::get<0>(it)->second;
 
-            auto descriptorPoolInfo = vk::DescriptorPoolCreateInfo();
             auto descriptorLayoutInfo = vk::DescriptorSetLayoutCreateInfo();
             auto range = mergedDesc.equal_range(set);
             for (auto e = range.first; e != range.second; ++e)
                 allocator.layoutBinding.insert(allocator.layoutBinding.end(), e->second.bindings.begin(),
                                                e->second.bindings.end());
+
+            // Uniform blocks are fed by the upload allocator and bound with a dynamic offset,
+            // dynamic descriptors are not allowed in update-after-bind sets so bindless sets keep static ones
+            const bool dynamic = std::ranges::all_of(allocator.layoutBinding, [](const auto& b){ return b.descriptorCount == 1; });
+            for (auto& b: allocator.layoutBinding)
+            {
+                if (dynamic && b.descriptorType == vk::DescriptorType::eUniformBuffer)
+                {
+                    b.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+                    allocator.dynamicCount++;
+                }
+            }
             descriptorLayoutInfo.setBindings(allocator.layoutBinding);
 
             vk::DescriptorSetLayoutBindingFlagsCreateInfo extended_info;
-            vk::DescriptorBindingFlags bindless_flags = vk::DescriptorBindingFlagBits::ePartiallyBound | vk::DescriptorBindingFlagBits::eUpdateAfterBind;
+            vk::DescriptorBindingFlags bindless_flags = vk::DescriptorBindingFlagBits::ePartiallyBound;
+            if (allocator.dynamicCount == 0)
+                bindless_flags |= vk::DescriptorBindingFlagBits::eUpdateAfterBind;
             std::vector<vk::DescriptorBindingFlags> binding_flags(descriptorLayoutInfo.bindingCount, bindless_flags);
             extended_info.setBindingFlags(binding_flags);
 
-            static constexpr uint32_t kMaxSets = 16;
-            descriptorLayoutInfo.setFlags(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool);
+            if (allocator.dynamicCount == 0)
+                descriptorLayoutInfo.setFlags(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool);
             descriptorLayoutInfo.setPNext(&extended_info);
             for (auto& b: allocator.layoutBinding)
-                descriptorPoolSizeInfo.emplace_back(b.descriptorType, b.descriptorCount * kMaxSets);
-            descriptorPoolInfo.setPoolSizes(descriptorPoolSizeInfo);
-            descriptorPoolInfo.setFlags(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind);
-            descriptorPoolInfo.setMaxSets(kMaxSets);
-            allocator.pool = device.createDescriptorPoolUnique(descriptorPoolInfo);
+                allocator.poolSizes.emplace_back(b.descriptorType, b.descriptorCount * kDescriptorPoolSets);
+            allocator.poolFlags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+            if (allocator.dynamicCount == 0)
+                allocator.poolFlags |= vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind;
+            allocator.pools.emplace_back(createDescriptorPool(device, allocator));
             allocator.layout = device.createDescriptorSetLayoutUnique(descriptorLayoutInfo);
             setLayouts.push_back(allocator.layout.get());
         }
@@ -736,17 +900,32 @@ namespace ler
 
         vk::Result res;
         vk::DescriptorSet descriptorSet;
-        const auto& allocator = descriptorAllocMap[set];
+        auto& allocator = descriptorAllocMap[set];
         vk::DescriptorSetAllocateInfo descriptorSetAllocInfo;
         descriptorSetAllocInfo.setDescriptorSetCount(1);
-        descriptorSetAllocInfo.setDescriptorPool(allocator.pool.get());
+        descriptorSetAllocInfo.setDescriptorPool(allocator.pools.back().get());
         descriptorSetAllocInfo.setPSetLayouts(&allocator.layout.get());
         res = m_context.device.allocateDescriptorSets(&descriptorSetAllocInfo, &descriptorSet);
+        if (res == vk::Result::eErrorOutOfPoolMemory || res == vk::Result::eErrorFragmentedPool)
+        {
+            allocator.pools.emplace_back(createDescriptorPool(m_context.device, allocator));
+            descriptorSetAllocInfo.setDescriptorPool(allocator.pools.back().get());
+            res = m_context.device.allocateDescriptorSets(&descriptorSetAllocInfo, &descriptorSet);
+        }
         assert(res == vk::Result::eSuccess);
-        descriptorPoolMap.emplace(static_cast<VkDescriptorSet>(descriptorSet), set);
+        descriptorPoolMap.emplace(static_cast<VkDescriptorSet>(descriptorSet), std::make_pair(set, descriptorSetAllocInfo.descriptorPool));
         return descriptorSet;
     }
 
+    void BasePipeline::freeDescriptorSet(vk::DescriptorSet descriptor)
+    {
+        auto it = descriptorPoolMap.find(static_cast<VkDescriptorSet>(descriptor));
+        if (it == descriptorPoolMap.end())
+            return;
+        m_context.device.freeDescriptorSets(it->second.second, descriptor);
+        descriptorPoolMap.erase(it);
+    }
+
     std::optional<vk::DescriptorType> BasePipeline::findBindingType(uint32_t set, uint32_t binding)
     {
         if(descriptorAllocMap.contains(set))
@@ -761,10 +940,16 @@ namespace ler
         return std::nullopt;
     }
 
+    uint32_t BasePipeline::getDynamicCount(uint32_t set) const
+    {
+        auto it = descriptorAllocMap.find(set);
+        return it == descriptorAllocMap.end() ? 0 : it->second.dynamicCount;
+    }
+
     void BasePipeline::updateSampler(vk::DescriptorSet descriptor, uint32_t binding, vk::Sampler sampler, vk::ImageLayout layout, vk::ImageView view)
     {
         auto d = static_cast<VkDescriptorSet>(descriptor);
-        uint32_t set = descriptorPoolMap[d];
+        uint32_t set = descriptorPoolMap[d].first;
         auto type = findBindingType(set, binding);
         std::vector<vk::WriteDescriptorSet> descriptorWrites;
         std::vector<vk::DescriptorImageInfo> descriptorImageInfo;
@@ -789,7 +974,7 @@ namespace ler
     void BasePipeline::updateSampler(vk::DescriptorSet descriptor, uint32_t binding, vk::Sampler& sampler, const std::span<TexturePtr>& textures)
     {
         auto d = static_cast<VkDescriptorSet>(descriptor);
-        uint32_t set = descriptorPoolMap[d];
+        uint32_t set = descriptorPoolMap[d].first;
         auto type = findBindingType(set, binding);
         std::vector<vk::WriteDescriptorSet> descriptorWrites;
         std::vector<vk::DescriptorImageInfo> descriptorImageInfo;
@@ -820,10 +1005,10 @@ namespace ler
         m_context.device.updateDescriptorSets(descriptorWrites, nullptr);
     }
 
-    void BasePipeline::updateStorage(vk::DescriptorSet descriptor, uint32_t binding, const BufferPtr& buffer, uint64_t byteSize)
+    void BasePipeline::updateStorage(vk::DescriptorSet descriptor, uint32_t binding, const BufferPtr& buffer, uint64_t byteSize, uint64_t offset)
     {
         auto d = static_cast<VkDescriptorSet>(descriptor);
-        uint32_t set = descriptorPoolMap[d];
+        uint32_t set = descriptorPoolMap[d].first;
         auto type = findBindingType(set, binding);
         std::vector<vk::WriteDescriptorSet> descriptorWrites;
 
@@ -833,174 +1018,606 @@ namespace ler
         descriptorWriteInfo.setDstSet(descriptor);
         descriptorWriteInfo.setDescriptorCount(1);
 
-        vk::DescriptorBufferInfo buffInfo(buffer->handle, 0, byteSize);
+        vk::DescriptorBufferInfo buffInfo(buffer->handle, offset, byteSize);
 
         descriptorWriteInfo.setBufferInfo(buffInfo);
         descriptorWrites.push_back(descriptorWriteInfo);
         m_context.device.updateDescriptorSets(descriptorWrites, nullptr);
     }
 
-    void addShaderStage(std::vector<vk::PipelineShaderStageCreateInfo>& stages, const ShaderPtr& shader)
+    bool BasePipeline::isReady() const
+    {
+        if(compilation.valid() && compilation.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
+        return bool(handle);
+    }
+
+    bool BasePipeline::hasFailed() const
+    {
+        return failed;
+    }
+
+    void BasePipeline::wait() const
     {
+        if(compilation.valid())
+            compilation.wait();
+    }
+
+    struct SpecializationData
+    {
+        std::vector<vk::SpecializationMapEntry> entries;
+        std::vector<uint32_t> data;
+        vk::SpecializationInfo info;
+
+        explicit SpecializationData(const SpecConstants& constants)
+        {
+            for(const auto& [id, value] : constants)
+            {
+                entries.emplace_back(id, static_cast<uint32_t>(data.size() * sizeof(uint32_t)), sizeof(uint32_t));
+                data.push_back(value);
+            }
+            info.setMapEntries(entries);
+            info.setDataSize(data.size() * sizeof(uint32_t));
+            info.setPData(data.data());
+        }
+    };
+
+    void addShaderStage(std::vector<vk::PipelineShaderStageCreateInfo>& stages, const ShaderPtr& shader, const SpecializationData& spec)
+    {
+        // Unused constant ids are ignored by the driver, all stages share the same map
         stages.emplace_back(
                 vk::PipelineShaderStageCreateFlags(),
                 shader->stageFlagBits,
                 shader->shaderModule.get(),
                 "main",
-                nullptr
+                spec.entries.empty() ? nullptr : &spec.info
         );
     }
 
     PipelinePtr LerDevice::createGraphicsPipeline(const std::span<ShaderPtr>& shaders, const PipelineInfo& info)
     {
-        vk::PipelineRenderingCreateInfo renderingCreateInfo;
-        renderingCreateInfo.setColorAttachmentFormats(info.colorAttach);
-        if(info.writeDepth)
-            renderingCreateInfo.setDepthAttachmentFormat(info.depthAttach);
+        return createGraphicsVariant(shaders, info, false);
+    }
 
-        auto pipeline = std::make_shared<GraphicsPipeline>(m_context);
-        std::vector<vk::PipelineShaderStageCreateInfo> pipelineShaderStages;
-        for (auto& shader: shaders)
-            addShaderStage(pipelineShaderStages, shader);
+    PipelinePtr LerDevice::createGraphicsPipelineAsync(const std::span<ShaderPtr>& shaders, const PipelineInfo& info)
+    {
+        return createGraphicsVariant(shaders, info, true);
+    }
 
-        // TOPOLOGY STATE
-        vk::PipelineInputAssemblyStateCreateInfo pia(vk::PipelineInputAssemblyStateCreateFlags(), info.topology);
+    size_t LerDevice::hashPipeline(const std::span<ShaderPtr>& shaders, const PipelineInfo& info)
+    {
+        // Shaders are deduplicated, their address identifies the content
+        size_t hash = hashPipelineInfo(info);
+        for(const ShaderPtr& shader : shaders)
+            hash_combine(hash, shader.get());
+        return hash;
+    }
 
-        // VIEWPORT STATE
-        auto viewport = vk::Viewport(0, 0, static_cast<float>(info.extent.width),
-                                     static_cast<float>(info.extent.height), 0, 1.0f);
-        auto renderArea = vk::Rect2D(vk::Offset2D(), info.extent);
+    size_t LerDevice::hashPipelineInfo(const PipelineInfo& info)
+    {
+        size_t hash = 0;
+        hash_combine(hash, info.extent.width);
+        hash_combine(hash, info.extent.height);
+        hash_combine(hash, info.topology);
+        hash_combine(hash, info.polygonMode);
+        hash_combine(hash, info.sampleCount);
+        hash_combine(hash, info.textureCount);
+        hash_combine(hash, info.writeDepth);
+        hash_combine(hash, info.lineWidth);
+        for(vk::Format format : info.colorAttach)
+            hash_combine(hash, format);
+        hash_combine(hash, info.depthAttach);
+        for(const auto& [id, value] : info.constants)
+        {
+            hash_combine(hash, id);
+            hash_combine(hash, value);
+        }
+        return hash;
+    }
 
-        vk::PipelineViewportStateCreateInfo pv(vk::PipelineViewportStateCreateFlagBits(), 1, &viewport, 1, &renderArea);
+    PipelinePtr LerDevice::createGraphicsVariant(const std::span<ShaderPtr>& shaders, const PipelineInfo& info, bool async)
+    {
+        // Identical requests share the same pipeline while alive
+        const size_t hash = hashPipeline(shaders, info);
+        {
+            std::lock_guard lock(m_pipelineMutex);
+            auto range = m_graphicsVariants.equal_range(hash);
+            for(auto it = range.first; it != range.second; ++it)
+            {
+                PipelinePtr cached = it->second.lock();
+                if(cached && !cached->hasFailed() && cached->info == info && std::ranges::equal(cached->shaders, shaders))
+                {
+                    if(!async)
+                        cached->wait();
+                    return cached;
+                }
+            }
+        }
 
-        // Multi Sampling STATE
-        vk::PipelineMultisampleStateCreateInfo pm(vk::PipelineMultisampleStateCreateFlags(), info.sampleCount);
+        // Registered once its compilation is scheduled, a reload never sees the future being assigned
+        PipelinePtr pipeline = prepareGraphicsPipeline(shaders, info);
+        compilePipeline(pipeline, async);
+        registerPipeline(pipeline);
+        std::lock_guard lock(m_pipelineMutex);
+        std::erase_if(m_graphicsVariants, [](const auto& e){ return e.second.expired(); });
+        m_graphicsVariants.emplace(hash, pipeline);
+        return pipeline;
+    }
 
-        // POLYGON STATE
+    PipelinePtr LerDevice::prepareGraphicsPipeline(const std::span<ShaderPtr>& shaders, const PipelineInfo& info)
+    {
+        auto pipeline = std::make_shared<GraphicsPipeline>(m_context);
+        pipeline->reflectPipelineLayout(m_context.device, shaders, info.textureCount);
+        pipeline->shaders.assign(shaders.begin(), shaders.end());
+        pipeline->info = info;
+        return pipeline;
+    }
+
+    struct GraphicsPipelineState
+    {
+        SpecializationData spec;
+        vk::PipelineRenderingCreateInfo rendering;
+        std::vector<vk::PipelineShaderStageCreateInfo> stages;
+        vk::PipelineVertexInputStateCreateInfo pvi;
+        vk::PipelineInputAssemblyStateCreateInfo pia;
+        vk::Viewport viewport;
+        vk::Rect2D renderArea;
+        vk::PipelineViewportStateCreateInfo pv;
+        vk::PipelineMultisampleStateCreateInfo pm;
         vk::PipelineRasterizationStateCreateInfo pr;
-        pr.setDepthClampEnable(VK_TRUE);
-        pr.setRasterizerDiscardEnable(VK_FALSE);
-        pr.setPolygonMode(info.polygonMode);
-        pr.setFrontFace(vk::FrontFace::eCounterClockwise);
-        pr.setDepthBiasEnable(VK_FALSE);
-        pr.setDepthBiasConstantFactor(0.f);
-        pr.setDepthBiasClamp(0.f);
-        pr.setDepthBiasSlopeFactor(0.f);
-        pr.setLineWidth(info.lineWidth);
-
-        // DEPTH & STENCIL STATE
         vk::PipelineDepthStencilStateCreateInfo pds;
-        pds.setDepthTestEnable(VK_TRUE);
-        pds.setDepthWriteEnable(info.writeDepth);
-        pds.setDepthCompareOp(vk::CompareOp::eLessOrEqual);
-        pds.setDepthBoundsTestEnable(VK_FALSE);
-        pds.setStencilTestEnable(VK_FALSE);
-        pds.setFront(vk::StencilOpState());
-        pds.setBack(vk::StencilOpState());
-        pds.setMinDepthBounds(0.f);
-        pds.setMaxDepthBounds(1.f);
-
-        // BLEND STATE
         std::vector<vk::PipelineColorBlendAttachmentState> colorBlendAttachments;
-        vk::PipelineColorBlendAttachmentState pcb;
-        pcb.setBlendEnable(VK_TRUE); // false
-        pcb.setSrcColorBlendFactor(vk::BlendFactor::eOne); //one //srcAlpha
-        pcb.setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha); //one //oneminussrcalpha
-        pcb.setColorBlendOp(vk::BlendOp::eAdd);
-        pcb.setSrcAlphaBlendFactor(vk::BlendFactor::eOne); //one //oneminussrcalpha
-        pcb.setDstAlphaBlendFactor(vk::BlendFactor::eZero); //zero
-        pcb.setAlphaBlendOp(vk::BlendOp::eAdd);
-        pcb.setColorWriteMask(
-                vk::ColorComponentFlagBits::eR |
-                vk::ColorComponentFlagBits::eG |
-                vk::ColorComponentFlagBits::eB |
-                vk::ColorComponentFlagBits::eA);
-
-        for (auto& attachment: info.colorAttach)
+        vk::PipelineColorBlendStateCreateInfo pbs;
+        std::vector<vk::DynamicState> dynamicStates;
+        vk::PipelineDynamicStateCreateInfo pdy;
+
+        // Create infos point to members, the state must stay in place
+        GraphicsPipelineState(const GraphicsPipelineState&) = delete;
+        GraphicsPipelineState(const std::span<const ShaderPtr>& shaders, const PipelineInfo& info) : spec(info.constants)
         {
-            if (guessImageAspectFlags(attachment) == vk::ImageAspectFlagBits::eColor)
-                colorBlendAttachments.push_back(pcb);
+            rendering.setColorAttachmentFormats(info.colorAttach);
+            if(info.writeDepth)
+                rendering.setDepthAttachmentFormat(info.depthAttach);
+
+            for (auto& shader: shaders)
+            {
+                addShaderStage(stages, shader, spec);
+                if (shader->stageFlagBits == vk::ShaderStageFlagBits::eVertex)
+                    pvi = shader->pvi;
+            }
+
+            // TOPOLOGY STATE
+            pia = vk::PipelineInputAssemblyStateCreateInfo(vk::PipelineInputAssemblyStateCreateFlags(), info.topology);
+
+            // VIEWPORT STATE
+            viewport = vk::Viewport(0, 0, static_cast<float>(info.extent.width),
+                                    static_cast<float>(info.extent.height), 0, 1.0f);
+            renderArea = vk::Rect2D(vk::Offset2D(), info.extent);
+
+            pv = vk::PipelineViewportStateCreateInfo(vk::PipelineViewportStateCreateFlagBits(), 1, &viewport, 1, &renderArea);
+
+            // Multi Sampling STATE
+            pm = vk::PipelineMultisampleStateCreateInfo(vk::PipelineMultisampleStateCreateFlags(), info.sampleCount);
+
+            // POLYGON STATE
+            pr.setDepthClampEnable(VK_TRUE);
+            pr.setRasterizerDiscardEnable(VK_FALSE);
+            pr.setPolygonMode(info.polygonMode);
+            pr.setFrontFace(vk::FrontFace::eCounterClockwise);
+            pr.setDepthBiasEnable(VK_FALSE);
+            pr.setDepthBiasConstantFactor(0.f);
+            pr.setDepthBiasClamp(0.f);
+            pr.setDepthBiasSlopeFactor(0.f);
+            pr.setLineWidth(info.lineWidth);
+
+            // DEPTH & STENCIL STATE
+            pds.setDepthTestEnable(VK_TRUE);
+            pds.setDepthWriteEnable(info.writeDepth);
+            pds.setDepthCompareOp(vk::CompareOp::eLessOrEqual);
+            pds.setDepthBoundsTestEnable(VK_FALSE);
+            pds.setStencilTestEnable(VK_FALSE);
+            pds.setFront(vk::StencilOpState());
+            pds.setBack(vk::StencilOpState());
+            pds.setMinDepthBounds(0.f);
+            pds.setMaxDepthBounds(1.f);
+
+            // BLEND STATE
+            vk::PipelineColorBlendAttachmentState pcb;
+            pcb.setBlendEnable(VK_TRUE); // false
+            pcb.setSrcColorBlendFactor(vk::BlendFactor::eOne); //one //srcAlpha
+            pcb.setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha); //one //oneminussrcalpha
+            pcb.setColorBlendOp(vk::BlendOp::eAdd);
+            pcb.setSrcAlphaBlendFactor(vk::BlendFactor::eOne); //one //oneminussrcalpha
+            pcb.setDstAlphaBlendFactor(vk::BlendFactor::eZero); //zero
+            pcb.setAlphaBlendOp(vk::BlendOp::eAdd);
+            pcb.setColorWriteMask(
+                    vk::ColorComponentFlagBits::eR |
+                    vk::ColorComponentFlagBits::eG |
+                    vk::ColorComponentFlagBits::eB |
+                    vk::ColorComponentFlagBits::eA);
+
+            for (auto& attachment: info.colorAttach)
+            {
+                if (LerDevice::guessImageAspectFlags(attachment) == vk::ImageAspectFlagBits::eColor)
+                    colorBlendAttachments.push_back(pcb);
+            }
+
+            pbs.setLogicOpEnable(VK_FALSE);
+            pbs.setLogicOp(vk::LogicOp::eClear);
+            pbs.setAttachments(colorBlendAttachments);
+
+            // DYNAMIC STATE
+            dynamicStates =
+                    {
+                            vk::DynamicState::eViewport,
+                            vk::DynamicState::eScissor
+                    };
+
+            pdy = vk::PipelineDynamicStateCreateInfo(vk::PipelineDynamicStateCreateFlags(), dynamicStates);
         }
+    };
 
-        vk::PipelineColorBlendStateCreateInfo pbs;
-        pbs.setLogicOpEnable(VK_FALSE);
-        pbs.setLogicOp(vk::LogicOp::eClear);
-        pbs.setAttachments(colorBlendAttachments);
+    void LerDevice::buildGraphicsPipeline(BasePipeline& pipeline, bool allowLibrary)
+    {
+        if(m_context.pipelineLibrary && allowLibrary)
+        {
+            linkGraphicsPipeline(pipeline);
+            return;
+        }
 
-        // DYNAMIC STATE
-        std::vector<vk::DynamicState> dynamicStates =
-                {
-                        vk::DynamicState::eViewport,
-                        vk::DynamicState::eScissor
-                };
+        GraphicsPipelineState state(pipeline.shaders, pipeline.info);
+        auto pipelineInfo = vk::GraphicsPipelineCreateInfo();
+        pipelineInfo.setPNext(&state.rendering);
+        pipelineInfo.setRenderPass(nullptr);
+        pipelineInfo.setLayout(pipeline.pipelineLayout.get());
+        pipelineInfo.setStages(state.stages);
+        pipelineInfo.setPVertexInputState(&state.pvi);
+        pipelineInfo.setPInputAssemblyState(&state.pia);
+        pipelineInfo.setPViewportState(&state.pv);
+        pipelineInfo.setPRasterizationState(&state.pr);
+        pipelineInfo.setPMultisampleState(&state.pm);
+        pipelineInfo.setPDepthStencilState(&state.pds);
+        pipelineInfo.setPColorBlendState(&state.pbs);
+        pipelineInfo.setPDynamicState(&state.pdy);
 
-        vk::PipelineDynamicStateCreateInfo pdy(vk::PipelineDynamicStateCreateFlags(), dynamicStates);
+        auto res = m_context.device.createGraphicsPipelineUnique(m_context.pipelineCache, pipelineInfo);
+        m_newPipelines = true;
+        assert(res.result == vk::Result::eSuccess);
+        pipeline.handle = std::move(res.value);
+    }
 
-        // PIPELINE LAYOUT STATE
-        auto layoutInfo = vk::PipelineLayoutCreateInfo();
-        std::vector<vk::PushConstantRange> pushConstants;
-        for (auto& shader: shaders)
-            pushConstants.insert(pushConstants.end(), shader->pushConstants.begin(), shader->pushConstants.end());
-        layoutInfo.setPushConstantRanges(pushConstants);
+    size_t LerDevice::LibraryKeyHash::operator()(const LibraryKey& key) const
+    {
+        size_t hash = hashPipelineInfo(key.info);
+        hash_combine(hash, static_cast<uint32_t>(key.part));
+        for(const ShaderPtr& shader : key.shaders)
+            hash_combine(hash, shader.get());
+        return hash;
+    }
 
-        // SHADER REFLECT
-        vk::PipelineVertexInputStateCreateInfo pvi;
-        for (auto& shader: shaders)
+    vk::Pipeline LerDevice::getPipelineLibrary(vk::GraphicsPipelineLibraryFlagBitsEXT part, const BasePipeline& pipeline)
+    {
+        // Each part only keeps the state it depends on, so variants differing elsewhere share it.
+        // Shader parts are tied to the layout, hence to the whole shader set and texture count.
+        // Parts linked together must see the same rendering formats, so shader parts key on them too.
+        using lf = vk::GraphicsPipelineLibraryFlagBitsEXT;
+        const PipelineInfo& info = pipeline.info;
+        LibraryKey key;
+        key.part = part;
+        switch(part)
         {
-            if (shader->stageFlagBits == vk::ShaderStageFlagBits::eVertex)
-                pvi = shader->pvi;
-            if (shader->stageFlagBits == vk::ShaderStageFlagBits::eFragment)
-            {
-                for (auto& e: shader->descriptorMap)
-                {
-                    for (auto& bind: e.second.bindings)
-                        if (bind.descriptorCount == 0 &&
-                            bind.descriptorType == vk::DescriptorType::eCombinedImageSampler)
-                            bind.descriptorCount = info.textureCount;
-                }
-            }
+            case lf::eVertexInputInterface:
+                std::ranges::copy_if(pipeline.shaders, std::back_inserter(key.shaders), [](const ShaderPtr& s){ return s->stageFlagBits == vk::ShaderStageFlagBits::eVertex; });
+                key.info.topology = info.topology;
+                break;
+            case lf::ePreRasterizationShaders:
+                key.shaders = pipeline.shaders;
+                key.info.textureCount = info.textureCount;
+                key.info.polygonMode = info.polygonMode;
+                key.info.lineWidth = info.lineWidth;
+                key.info.constants = info.constants;
+                key.info.writeDepth = info.writeDepth;
+                key.info.colorAttach = info.colorAttach;
+                key.info.depthAttach = info.depthAttach;
+                break;
+            case lf::eFragmentShader:
+                key.shaders = pipeline.shaders;
+                key.info.textureCount = info.textureCount;
+                key.info.sampleCount = info.sampleCount;
+                key.info.writeDepth = info.writeDepth;
+                key.info.constants = info.constants;
+                key.info.colorAttach = info.colorAttach;
+                key.info.depthAttach = info.depthAttach;
+                break;
+            case lf::eFragmentOutputInterface:
+                key.info.sampleCount = info.sampleCount;
+                key.info.writeDepth = info.writeDepth;
+                key.info.colorAttach = info.colorAttach;
+                key.info.depthAttach = info.depthAttach;
+                break;
         }
 
-        pipeline->reflectPipelineLayout(m_context.device, shaders);
+        {
+            std::lock_guard lock(m_libraryMutex);
+            auto it = m_libraries.find(key);
+            if(it != m_libraries.end())
+                return it->second.get();
+        }
+
+        GraphicsPipelineState state(key.shaders, key.info);
+        vk::GraphicsPipelineLibraryCreateInfoEXT libraryInfo(part);
+        if(part != lf::eVertexInputInterface)
+            libraryInfo.setPNext(&state.rendering);
 
         auto pipelineInfo = vk::GraphicsPipelineCreateInfo();
-        pipelineInfo.setPNext(&renderingCreateInfo);
-        pipelineInfo.setRenderPass(nullptr);
-        pipelineInfo.setLayout(pipeline->pipelineLayout.get());
-        pipelineInfo.setStages(pipelineShaderStages);
-        pipelineInfo.setPVertexInputState(&pvi);
-        pipelineInfo.setPInputAssemblyState(&pia);
-        pipelineInfo.setPViewportState(&pv);
-        pipelineInfo.setPRasterizationState(&pr);
-        pipelineInfo.setPMultisampleState(&pm);
-        pipelineInfo.setPDepthStencilState(&pds);
-        pipelineInfo.setPColorBlendState(&pbs);
-        pipelineInfo.setPDynamicState(&pdy);
+        pipelineInfo.setFlags(vk::PipelineCreateFlagBits::eLibraryKHR);
+        pipelineInfo.setPNext(&libraryInfo);
+        std::vector<vk::PipelineShaderStageCreateInfo> stages;
+        switch(part)
+        {
+            case lf::eVertexInputInterface:
+                pipelineInfo.setPVertexInputState(&state.pvi);
+                pipelineInfo.setPInputAssemblyState(&state.pia);
+                break;
+            case lf::ePreRasterizationShaders:
+                std::ranges::copy_if(state.stages, std::back_inserter(stages), [](const auto& s){ return s.stage != vk::ShaderStageFlagBits::eFragment; });
+                pipelineInfo.setStages(stages);
+                pipelineInfo.setLayout(pipeline.pipelineLayout.get());
+                pipelineInfo.setPViewportState(&state.pv);
+                pipelineInfo.setPRasterizationState(&state.pr);
+                pipelineInfo.setPDynamicState(&state.pdy);
+                break;
+            case lf::eFragmentShader:
+                std::ranges::copy_if(state.stages, std::back_inserter(stages), [](const auto& s){ return s.stage == vk::ShaderStageFlagBits::eFragment; });
+                pipelineInfo.setStages(stages);
+                pipelineInfo.setLayout(pipeline.pipelineLayout.get());
+                pipelineInfo.setPMultisampleState(&state.pm);
+                pipelineInfo.setPDepthStencilState(&state.pds);
+                break;
+            case lf::eFragmentOutputInterface:
+                pipelineInfo.setPMultisampleState(&state.pm);
+                pipelineInfo.setPColorBlendState(&state.pbs);
+                break;
+        }
+
+        auto res = m_context.device.createGraphicsPipelineUnique(m_context.pipelineCache, pipelineInfo);
+        m_newPipelines = true;
+        assert(res.result == vk::Result::eSuccess);
+
+        // Another thread may have built the same part meanwhile, keep the first one
+        std::lock_guard lock(m_libraryMutex);
+        auto [it, inserted] = m_libraries.try_emplace(std::move(key), std::move(res.value));
+        return it->second.get();
+    }
+
+    void LerDevice::linkGraphicsPipeline(BasePipeline& pipeline)
+    {
+        using lf = vk::GraphicsPipelineLibraryFlagBitsEXT;
+        std::array<vk::Pipeline, 4> libraries = {
+            getPipelineLibrary(lf::eVertexInputInterface, pipeline),
+            getPipelineLibrary(lf::ePreRasterizationShaders, pipeline),
+            getPipelineLibrary(lf::eFragmentShader, pipeline),
+            getPipelineLibrary(lf::eFragmentOutputInterface, pipeline)
+        };
+
+        // Fast link without link time optimization
+        vk::PipelineLibraryCreateInfoKHR linkInfo(libraries);
+        auto pipelineInfo = vk::GraphicsPipelineCreateInfo();
+        pipelineInfo.setPNext(&linkInfo);
+        pipelineInfo.setLayout(pipeline.pipelineLayout.get());
 
         auto res = m_context.device.createGraphicsPipelineUnique(m_context.pipelineCache, pipelineInfo);
+        m_newPipelines = true;
         assert(res.result == vk::Result::eSuccess);
-        pipeline->handle = std::move(res.value);
+        pipeline.handle = std::move(res.value);
+    }
+
+    PipelinePtr LerDevice::createComputePipeline(const ShaderPtr& shader, const SpecConstants& constants, bool fullSubgroups)
+    {
+        return createComputeVariant(shader, constants, fullSubgroups, false);
+    }
+
+    PipelinePtr LerDevice::createComputePipelineAsync(const ShaderPtr& shader, const SpecConstants& constants, bool fullSubgroups)
+    {
+        return createComputeVariant(shader, constants, fullSubgroups, true);
+    }
+
+    PipelinePtr LerDevice::createComputeVariant(const ShaderPtr& shader, const SpecConstants& constants, bool fullSubgroups, bool async)
+    {
+        // Variants of the same shader are shared while alive
+        auto variant = std::make_tuple(shader->name, constants, fullSubgroups);
+        {
+            std::lock_guard lock(m_pipelineMutex);
+            auto it = m_computeVariants.find(variant);
+            if(it != m_computeVariants.end())
+            {
+                PipelinePtr cached = it->second.lock();
+                if(cached && !cached->hasFailed())
+                {
+                    if(!async)
+                        cached->wait();
+                    return cached;
+                }
+            }
+        }
+
+        // Cached and registered once compilation is scheduled, so others never see an unscheduled pipeline
+        PipelinePtr pipeline = prepareComputePipeline(shader, constants, fullSubgroups);
+        compilePipeline(pipeline, async);
+        registerPipeline(pipeline);
+        std::lock_guard lock(m_pipelineMutex);
+        m_computeVariants[variant] = pipeline;
         return pipeline;
     }
 
-    PipelinePtr LerDevice::createComputePipeline(const ShaderPtr& shader)
+    PipelinePtr LerDevice::prepareComputePipeline(const ShaderPtr& shader, const SpecConstants& constants, bool fullSubgroups)
     {
         auto pipeline = std::make_shared<ComputePipeline>(m_context);
-        std::vector<vk::PipelineShaderStageCreateInfo> pipelineShaderStages;
-        addShaderStage(pipelineShaderStages, shader);
-
         std::vector<ShaderPtr> shaders = {shader};
         pipeline->reflectPipelineLayout(m_context.device, shaders);
+        pipeline->bindPoint = vk::PipelineBindPoint::eCompute;
+        pipeline->shaders = std::move(shaders);
+        pipeline->info.constants = constants;
+        pipeline->info.fullSubgroups = fullSubgroups;
+        return pipeline;
+    }
+
+    void LerDevice::buildComputePipeline(BasePipeline& pipeline)
+    {
+        SpecializationData spec(pipeline.info.constants);
+        std::vector<vk::PipelineShaderStageCreateInfo> pipelineShaderStages;
+        addShaderStage(pipelineShaderStages, pipeline.shaders.front(), spec);
+
+        // The workgroup width must then be a multiple of the required size
+        vk::PipelineShaderStageRequiredSubgroupSizeCreateInfo subgroupSize(m_context.subgroupSize);
+        if(pipeline.info.fullSubgroups && m_context.fullSubgroups)
+        {
+            pipelineShaderStages.front().setFlags(vk::PipelineShaderStageCreateFlagBits::eRequireFullSubgroups);
+            pipelineShaderStages.front().setPNext(&subgroupSize);
+        }
 
         auto pipelineInfo = vk::ComputePipelineCreateInfo();
         pipelineInfo.setStage(pipelineShaderStages.front());
-        pipelineInfo.setLayout(pipeline->pipelineLayout.get());
+        pipelineInfo.setLayout(pipeline.pipelineLayout.get());
 
         auto res = m_context.device.createComputePipelineUnique(m_context.pipelineCache, pipelineInfo);
-        pipeline->bindPoint = vk::PipelineBindPoint::eCompute;
+        m_newPipelines = true;
         assert(res.result == vk::Result::eSuccess);
-        pipeline->handle = std::move(res.value);
-        return pipeline;
+        pipeline.handle = std::move(res.value);
+    }
+
+    void LerDevice::compilePipeline(const PipelinePtr& pipeline, bool async)
+    {
+        auto build = [this, pipeline]()
+        {
+            if(pipeline->bindPoint == vk::PipelineBindPoint::eCompute)
+                buildComputePipeline(*pipeline);
+            else
+                buildGraphicsPipeline(*pipeline);
+        };
+
+        if(!async)
+        {
+            build();
+            return;
+        }
+
+        // The pipeline cache is internally synchronized, drivers compile in parallel
+        pipeline->compilation = Async::GetPool().submit([this, build, pipeline]()
+        {
+            try
+            {
+                build();
+                return;
+            }
+            catch(const std::exception& e)
+            {
+                log::error("Failed to compile pipeline {}: {}", pipeline->shaders.front()->name, e.what());
+            }
+
+            // Linking may fail where a monolithic build does not
+            if(pipeline->bindPoint == vk::PipelineBindPoint::eGraphics && m_context.pipelineLibrary)
+            {
+                try
+                {
+                    buildGraphicsPipeline(*pipeline, false);
+                    log::warn("Pipeline {}: fall back to a monolithic build", pipeline->shaders.front()->name);
+                    return;
+                }
+                catch(const std::exception& e)
+                {
+                    log::error("Failed to compile pipeline {}: {}", pipeline->shaders.front()->name, e.what());
+                }
+            }
+            pipeline->failed = true;
+        }).share();
+    }
+
+    void LerDevice::registerPipeline(const PipelinePtr& pipeline)
+    {
+        std::lock_guard lock(m_pipelineMutex);
+        std::erase_if(m_pipelines, [](const std::weak_ptr<BasePipeline>& p){ return p.expired(); });
+        m_pipelines.emplace_back(pipeline);
+    }
+
+    bool LerDevice::isLayoutCompatible(const BasePipeline& a, const BasePipeline& b)
+    {
+        if(a.pushConstants != b.pushConstants || a.descriptorAllocMap.size() != b.descriptorAllocMap.size())
+            return false;
+
+        for(const auto& [set, allocator] : a.descriptorAllocMap)
+        {
+            auto it = b.descriptorAllocMap.find(set);
+            if(it == b.descriptorAllocMap.end() || it->second.layoutBinding != allocator.layoutBinding)
+                return false;
+        }
+        return true;
+    }
+
+    void LerDevice::rebuildPipelines(const std::string& shaderName)
+    {
+        // Parts built from the previous version are never hit again, linked pipelines keep working without them
+        {
+            std::lock_guard lock(m_libraryMutex);
+            std::erase_if(m_libraries, [&](auto& entry)
+            {
+                if(std::ranges::none_of(entry.first.shaders, [&](const ShaderPtr& s){ return s->name == shaderName; }))
+                    return false;
+                release(std::make_shared<vk::UniquePipeline>(std::move(entry.second)));
+                return true;
+            });
+        }
+
+        std::vector<PipelinePtr> affected;
+        {
+            std::lock_guard lock(m_pipelineMutex);
+            for(const auto& weak : m_pipelines)
+            {
+                PipelinePtr pipeline = weak.lock();
+                if(pipeline && std::ranges::any_of(pipeline->shaders, [&](const ShaderPtr& s){ return s->name == shaderName; }))
+                    affected.emplace_back(pipeline);
+            }
+        }
+
+        for(const PipelinePtr& pipeline : affected)
+        {
+            pipeline->wait();
+
+            // Unchanged stages come back from the shader cache
+            PipelinePtr rebuilt;
+            try
+            {
+                std::vector<ShaderPtr> shaders;
+                for(const ShaderPtr& shader : pipeline->shaders)
+                    shaders.emplace_back(createShader(shader->name));
+
+                if(pipeline->bindPoint == vk::PipelineBindPoint::eCompute)
+                    rebuilt = prepareComputePipeline(shaders.front(), pipeline->info.constants, pipeline->info.fullSubgroups);
+                else
+                    rebuilt = prepareGraphicsPipeline(shaders, pipeline->info);
+                compilePipeline(rebuilt, false);
+            }
+            catch(const std::exception& e)
+            {
+                log::error("Reload {}: {}", shaderName, e.what());
+                continue;
+            }
+
+            if(!isLayoutCompatible(*pipeline, *rebuilt))
+            {
+                log::warn("Reload {}: pipeline layout changed, restart required", shaderName);
+                continue;
+            }
+
+            // Keep layout and descriptor sets, the old handle lives until the GPU is done with it
+            std::swap(pipeline->handle, rebuilt->handle);
+            pipeline->shaders = std::move(rebuilt->shaders);
+            pipeline->failed = false;
+            release(rebuilt);
+        }
+
+        if(!affected.empty())
+            log::info("Reload {}: {} pipelines", shaderName, affected.size());
     }
 
     void LerDevice::updateSampler(vk::DescriptorSet descriptorSet, uint32_t binding, vk::Sampler& sampler, const std::span<TexturePtr>& textures, vk::DescriptorType type)
@@ -1104,6 +1721,8 @@ namespace ler
         m_context.device.updateDescriptorSets(descriptorWrites, nullptr);
     }
 
+    static std::atomic<uint64_t> g_queueCounter = 0;
+
     Queue::Queue(const VulkanContext& context, CommandQueue queueID, uint32_t queueFamilyIndex)
             : m_context(context), m_queueKind(queueID), m_queueFamilyIndex(queueFamilyIndex)
     {
@@ -1115,53 +1734,93 @@ namespace ler
 
         trackingSemaphore = context.device.createSemaphore(semaphoreInfo);
         m_queue = m_context.device.getQueue(queueFamilyIndex, 0);
+        m_uid = ++g_queueCounter;
     }
 
     Queue::~Queue()
     {
+        m_commandBuffersInFlight.clear();
+        for(auto& arena : m_arenas)
+        {
+            for(CommandFrame& frame : arena->frames)
+                m_context.device.destroyCommandPool(frame.pool);
+        }
+
         m_context.device.destroySemaphore(trackingSemaphore);
         trackingSemaphore = vk::Semaphore();
     }
 
-    CommandPtr Queue::createCommandBuffer()
+    std::shared_ptr<Queue::CommandArena> Queue::getThreadArena()
     {
-        vk::Result res;
+        // Queue IDs are never reused, only the first use per thread takes the lock
+        thread_local std::unordered_map<uint64_t, std::weak_ptr<CommandArena>> arenas;
+        auto it = arenas.find(m_uid);
+        if(it != arenas.end())
+        {
+            if(std::shared_ptr<CommandArena> arena = it->second.lock())
+                return arena;
+        }
 
-        CommandPtr ret = std::make_shared<TrackedCommandBuffer>(m_context);
-        ret->queueKind = m_queueKind;
+        // Forget the arenas of destroyed queues
+        std::erase_if(arenas, [](const auto& e){ return e.second.expired(); });
 
         auto cmdPoolInfo = vk::CommandPoolCreateInfo();
         cmdPoolInfo.setQueueFamilyIndex(m_queueFamilyIndex);
-        cmdPoolInfo.setFlags(
-                vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient);
+        cmdPoolInfo.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
 
-        res = m_context.device.createCommandPool(&cmdPoolInfo, nullptr, &ret->cmdPool);
+        auto arena = std::make_shared<CommandArena>();
+        for(CommandFrame& frame : arena->frames)
+            frame.pool = m_context.device.createCommandPool(cmdPoolInfo);
+        arenas[m_uid] = arena;
 
-        // allocate command buffer
-        auto allocInfo = vk::CommandBufferAllocateInfo();
-        allocInfo.setLevel(vk::CommandBufferLevel::ePrimary);
-        allocInfo.setCommandPool(ret->cmdPool);
-        allocInfo.setCommandBufferCount(1);
+        std::lock_guard lock(m_mutex);
+        m_arenas.emplace_back(arena);
+        return arena;
+    }
 
-        res = m_context.device.allocateCommandBuffers(&allocInfo, &ret->cmdBuf);
+    void Queue::recycleFrame(CommandFrame& frame)
+    {
+        if(frame.used == 0 || frame.pending.load(std::memory_order_acquire) > 0)
+            return;
 
-        return ret;
+        uint64_t lastSubmissionID = frame.lastSubmissionID.load(std::memory_order_relaxed);
+        if(lastSubmissionID > m_lastFinishedID && lastSubmissionID > m_context.device.getSemaphoreCounterValue(trackingSemaphore))
+            return;
+
+        m_context.device.resetCommandPool(frame.pool);
+        frame.used = 0;
     }
 
     CommandPtr Queue::getOrCreateCommandBuffer()
     {
-        std::lock_guard lock(m_mutex);
-
-        CommandPtr cmdBuf;
-        if (m_commandBuffersPool.empty())
+        // Pools still in flight keep growing until a later cycle
+        std::shared_ptr<CommandArena> arena = getThreadArena();
+        uint64_t frameIndex = m_frameIndex.load(std::memory_order_acquire);
+        if(arena->frameIndex != frameIndex)
         {
-            cmdBuf = createCommandBuffer();
-        } else
+            arena->frameIndex = frameIndex;
+            arena->current = &arena->frames[frameIndex % kMaxFramesInFlight];
+            recycleFrame(*arena->current);
+        }
+
+        CommandFrame& frame = *arena->current;
+        if(frame.used == frame.buffers.size())
         {
-            cmdBuf = m_commandBuffersPool.back();
-            m_commandBuffersPool.pop_back();
+            auto allocInfo = vk::CommandBufferAllocateInfo();
+            allocInfo.setLevel(vk::CommandBufferLevel::ePrimary);
+            allocInfo.setCommandPool(frame.pool);
+            allocInfo.setCommandBufferCount(std::max<uint32_t>(4u, uint32_t(frame.buffers.size())));
+
+            auto buffers = m_context.device.allocateCommandBuffers(allocInfo);
+            frame.buffers.insert(frame.buffers.end(), buffers.begin(), buffers.end());
         }
 
+        CommandPtr cmdBuf = std::make_shared<TrackedCommandBuffer>(m_context);
+        cmdBuf->queueKind = m_queueKind;
+        cmdBuf->cmdBuf = frame.buffers[frame.used++];
+        cmdBuf->frame = std::shared_ptr<CommandFrame>(arena, &frame);
+        frame.pending.fetch_add(1, std::memory_order_relaxed);
+
         cmdBuf->cmdBuf.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
         return cmdBuf;
     }
@@ -1171,8 +1830,8 @@ namespace ler
         if (!semaphore)
             return;
 
-        m_waitSemaphores.push_back(semaphore);
-        m_waitSemaphoreValues.push_back(value);
+        std::lock_guard lock(m_mutex);
+        m_waitSemaphores.emplace_back(semaphore, value, vk::PipelineStageFlagBits2::eAllCommands);
     }
 
     void Queue::addSignalSemaphore(vk::Semaphore semaphore, uint64_t value)
@@ -1180,8 +1839,8 @@ namespace ler
         if (!semaphore)
             return;
 
-        m_signalSemaphores.push_back(semaphore);
-        m_signalSemaphoreValues.push_back(value);
+        std::lock_guard lock(m_mutex);
+        m_signalSemaphores.emplace_back(semaphore, value, vk::PipelineStageFlagBits2::eAllCommands);
     }
 
     uint64_t Queue::updateLastFinishedID()
@@ -1203,9 +1862,6 @@ namespace ler
             {
                 if(m_queueKind == CommandQueue::Transfer)
                     Event::GetDispatcher().enqueue<CommandCompleteEvent>(cmd->submissionID, m_queueKind);
-                cmd->submissionID = 0;
-                cmd->referencedResources.clear();
-                m_commandBuffersPool.push_back(cmd);
             } else
             {
                 m_commandBuffersInFlight.push_back(cmd);
@@ -1234,6 +1890,9 @@ namespace ler
         if (pollCommandList(submissionID))
             return true;
 
+        if (submissionID > m_lastFlushedID)
+            flush();
+
         std::array<const vk::Semaphore, 1> semaphores = {trackingSemaphore};
         std::array<uint64_t, 1> waitValues = {submissionID};
 
@@ -1248,59 +1907,71 @@ namespace ler
 
     uint64_t Queue::submit(std::vector<CommandPtr>& ppCmd)
     {
-        std::vector<vk::PipelineStageFlags> waitStageArray(m_waitSemaphores.size());
-        std::vector<vk::CommandBuffer> commandBuffers(ppCmd.size());
+        std::lock_guard lock(m_mutex);
 
-        for (size_t i = 0; i < m_waitSemaphores.size(); i++)
-        {
-            waitStageArray[i] = vk::PipelineStageFlagBits::eTopOfPipe;
-        }
+        // Waits only apply to the commands that follow them
+        if (m_batches.empty() || m_batches.back().closed || (!m_waitSemaphores.empty() && !m_batches.back().commands.empty()))
+            m_batches.emplace_back().submissionID = ++m_lastSubmittedID;
 
-        m_lastSubmittedID++;
+        SubmitBatch& batch = m_batches.back();
+        batch.waits.insert(batch.waits.end(), m_waitSemaphores.begin(), m_waitSemaphores.end());
+        m_waitSemaphores.clear();
 
-        for (size_t i = 0; i < ppCmd.size(); i++)
+        for (const CommandPtr& commandBuffer : ppCmd)
         {
-            CommandPtr commandBuffer = ppCmd[i];
-
             // It's time!
-            commandBuffer->cmdBuf.end();
+            commandBuffer->close();
 
-            commandBuffers[i] = commandBuffer->cmdBuf;
-            commandBuffer->submissionID = m_lastSubmittedID;
+            batch.commands.emplace_back(commandBuffer->cmdBuf);
+            commandBuffer->markSubmitted(batch.submissionID);
             m_commandBuffersInFlight.push_back(commandBuffer);
         }
 
-        m_signalSemaphores.push_back(trackingSemaphore);
-        m_signalSemaphoreValues.push_back(m_lastSubmittedID);
+        // Signals fire after these commands, later ones go to the next batch
+        if (!m_signalSemaphores.empty())
+        {
+            batch.signals.insert(batch.signals.end(), m_signalSemaphores.begin(), m_signalSemaphores.end());
+            m_signalSemaphores.clear();
+            batch.closed = true;
+        }
 
-        auto timelineSemaphoreInfo = vk::TimelineSemaphoreSubmitInfo()
-                .setSignalSemaphoreValueCount(uint32_t(m_signalSemaphoreValues.size()))
-                .setPSignalSemaphoreValues(m_signalSemaphoreValues.data());
+        return batch.submissionID;
+    }
 
-        if (!m_waitSemaphoreValues.empty())
+    void Queue::flush()
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_batches.empty())
+            return;
+
+        std::vector<vk::SubmitInfo2> submitInfos;
+        submitInfos.reserve(m_batches.size());
+        uint32_t commandCount = 0;
+        for (SubmitBatch& batch : m_batches)
         {
-            timelineSemaphoreInfo.setWaitSemaphoreValueCount(uint32_t(m_waitSemaphoreValues.size()));
-            timelineSemaphoreInfo.setPWaitSemaphoreValues(m_waitSemaphoreValues.data());
-        }
+            batch.signals.emplace_back(trackingSemaphore, batch.submissionID, vk::PipelineStageFlagBits2::eAllCommands);
+            commandCount += uint32_t(batch.commands.size());
 
-        auto submitInfo = vk::SubmitInfo()
-                .setPNext(&timelineSemaphoreInfo)
-                .setCommandBufferCount(uint32_t(ppCmd.size()))
-                .setPCommandBuffers(commandBuffers.data())
-                .setWaitSemaphoreCount(uint32_t(m_waitSemaphores.size()))
-                .setPWaitSemaphores(m_waitSemaphores.data())
-                .setPWaitDstStageMask(waitStageArray.data())
-                .setSignalSemaphoreCount(uint32_t(m_signalSemaphores.size()))
-                .setPSignalSemaphores(m_signalSemaphores.data());
+            auto& submitInfo = submitInfos.emplace_back();
+            submitInfo.setWaitSemaphoreInfos(batch.waits);
+            submitInfo.setCommandBufferInfos(batch.commands);
+            submitInfo.setSignalSemaphoreInfos(batch.signals);
+        }
 
-        m_queue.submit(submitInfo);
+        auto start = std::chrono::steady_clock::now();
+        m_queue.submit2(submitInfos);
+        m_stats.duration = std::chrono::steady_clock::now() - start;
+        m_stats.batchCount = uint32_t(submitInfos.size());
+        m_stats.commandCount = commandCount;
 
-        m_waitSemaphores.clear();
-        m_waitSemaphoreValues.clear();
-        m_signalSemaphores.clear();
-        m_signalSemaphoreValues.clear();
+        m_lastFlushedID = m_batches.back().submissionID;
+        m_batches.clear();
+    }
 
-        return m_lastSubmittedID;
+    Queue::SubmitStats Queue::getSubmitStats() const
+    {
+        std::lock_guard lock(m_mutex);
+        return m_stats;
     }
 
     void LerDevice::queueWaitForSemaphore(CommandQueue waitQueueID, vk::Semaphore semaphore, uint64_t value)
@@ -1315,6 +1986,17 @@ namespace ler
         executionQueue.addSignalSemaphore(semaphore, value);
     }
 
+    void LerDevice::queueWaitForCommand(CommandQueue waitQueueID, CommandQueue executionQueueID, uint64_t submissionId)
+    {
+        // Same queue is already ordered, barriers take care of memory
+        Queue* waitQueue = m_queues[uint32_t(waitQueueID)].get();
+        Queue* executionQueue = m_queues[uint32_t(executionQueueID)].get();
+        if(waitQueue == nullptr || executionQueue == nullptr || waitQueue == executionQueue)
+            return;
+
+        waitQueue->addWaitSemaphore(executionQueue->trackingSemaphore, submissionId);
+    }
+
     bool LerDevice::pollCommand(uint64_t submissionId, CommandQueue kind)
     {
         return m_queues[uint32_t(kind)]->pollCommandList(submissionId);
@@ -1328,6 +2010,9 @@ namespace ler
 
     CommandPtr LerDevice::createCommand(CommandQueue kind)
     {
+        // Without a dedicated family, compute work runs inline on the graphics queue
+        if(m_queues[int(kind)] == nullptr)
+            kind = CommandQueue::Graphics;
         return m_queues[int(kind)]->getOrCreateCommandBuffer();
     }
 
@@ -1347,7 +2032,9 @@ namespace ler
 
     void LerDevice::submitOneshot(CommandPtr& cmd)
     {
-        cmd->cmdBuf.end();
+        // Keep queue order with the pending batches
+        m_queues[0]->flush();
+        cmd->close();
         vk::UniqueFence fence = m_context.device.createFenceUnique({});
 
         vk::SubmitInfo submitInfo;
@@ -1357,17 +2044,148 @@ namespace ler
         auto res = m_context.device.waitForFences(fence.get(), true, std::numeric_limits<uint64_t>::max());
         assert(res == vk::Result::eSuccess);
 
-        m_queues[0]->m_commandBuffersPool.push_back(cmd);
+        cmd->markSubmitted(0);
+    }
+
+    void LerDevice::flushCommands()
+    {
+        for (auto& queue: m_queues)
+        {
+            if (queue)
+                queue->flush();
+        }
+    }
+
+    void LerDevice::setFramesInFlight(uint32_t count)
+    {
+        m_framesInFlight = std::clamp(count, 1u, kMaxFramesInFlight);
+        m_frameIndex = 0;
+    }
+
+    void LerDevice::release(std::shared_ptr<void> object)
+    {
+        Release entry;
+        entry.object = std::move(object);
+        for(uint32_t i = 0; i < m_queues.size(); ++i)
+        {
+            if(m_queues[i])
+                entry.submissionIDs[i] = m_queues[i]->getLastSubmittedID();
+        }
+
+        std::lock_guard lock(m_releaseMutex);
+        m_releases.emplace_back(std::move(entry));
+    }
+
+    void LerDevice::release(const PipelinePtr& pipeline, vk::DescriptorSet descriptor)
+    {
+        release(std::shared_ptr<void>(nullptr, [pipeline, descriptor](void*){ pipeline->freeDescriptorSet(descriptor); }));
+    }
+
+    void LerDevice::waitForRendering()
+    {
+        for(CommandQueue kind : {CommandQueue::Graphics, CommandQueue::Compute})
+        {
+            if(Queue* queue = m_queues[uint32_t(kind)].get())
+                queue->waitCommandList(queue->getLastSubmittedID(), UINT64_MAX);
+        }
+    }
+
+    void LerDevice::beginFrame()
+    {
+        m_queues[uint32_t(CommandQueue::Graphics)]->waitCommandList(m_frameSubmissions[m_frameIndex], UINT64_MAX);
+        m_uploadAllocator->beginFrame(m_frameIndex);
+    }
+
+    void LerDevice::endFrame()
+    {
+        m_frameSubmissions[m_frameIndex] = m_queues[uint32_t(CommandQueue::Graphics)]->getLastSubmittedID();
+        m_frameIndex = (m_frameIndex + 1) % m_framesInFlight;
+    }
+
+    void UploadAllocator::init(LerDevice* device, uint32_t segmentSize)
+    {
+        using bu = vk::BufferUsageFlagBits;
+        const VulkanContext& context = device->getVulkanContext();
+        const vk::PhysicalDeviceLimits limits = context.physicalDevice.getProperties().limits;
+        m_alignment = uint32_t(std::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment));
+        m_segmentSize = (segmentSize + m_alignment - 1) & ~(m_alignment - 1);
+
+        auto usages = bu::eUniformBuffer | bu::eStorageBuffer | bu::eIndirectBuffer | bu::eVertexBuffer | bu::eIndexBuffer;
+        m_buffer = device->createBuffer(m_segmentSize * kMaxFramesInFlight, usages, true);
+        m_address = context.device.getBufferAddress(vk::BufferDeviceAddressInfo(m_buffer->handle));
+    }
+
+    void UploadAllocator::beginFrame(uint32_t frameIndex)
+    {
+        // The frame throttle guarantees the GPU is done with this segment
+        m_segmentOffset = frameIndex * m_segmentSize;
+        m_head.store(0, std::memory_order_relaxed);
+    }
+
+    UploadAllocation UploadAllocator::allocate(uint32_t byteSize)
+    {
+        const uint32_t alignedSize = (byteSize + m_alignment - 1) & ~(m_alignment - 1);
+        const uint32_t offset = m_head.fetch_add(alignedSize, std::memory_order_relaxed);
+        if(offset + alignedSize > m_segmentSize)
+        {
+            log::error("Upload allocator out of memory: {} bytes requested", byteSize);
+            return {};
+        }
+
+        UploadAllocation alloc;
+        alloc.buffer = m_buffer->handle;
+        alloc.offset = m_segmentOffset + offset;
+        alloc.size = byteSize;
+        alloc.data = static_cast<std::byte*>(m_buffer->hostInfo.pMappedData) + alloc.offset;
+        alloc.address = m_address + alloc.offset;
+        return alloc;
     }
 
     void LerDevice::runGarbageCollection()
     {
+        flushCommands();
+
         for (auto& queue: m_queues)
         {
             if (queue)
             {
                 queue->retireCommandBuffers(*this);
+                queue->advanceFrame();
+            }
+        }
+
+        // Expired objects are moved out and destroyed in bulk outside the lock
+        std::vector<Release> expired;
+        {
+            std::lock_guard lock(m_releaseMutex);
+            std::array<uint64_t, uint32_t(CommandQueue::Count)> lastFinishedIDs = {};
+            for(uint32_t i = 0; i < m_queues.size() && !m_releases.empty(); ++i)
+            {
+                if(m_queues[i])
+                    lastFinishedIDs[i] = m_queues[i]->updateLastFinishedID();
             }
+
+            auto it = std::partition(m_releases.begin(), m_releases.end(), [&lastFinishedIDs](const Release& r)
+            {
+                for(uint32_t i = 0; i < r.submissionIDs.size(); ++i)
+                {
+                    if(r.submissionIDs[i] > lastFinishedIDs[i])
+                        return true;
+                }
+                return false;
+            });
+            expired.assign(std::make_move_iterator(it), std::make_move_iterator(m_releases.end()));
+            m_releases.erase(it, m_releases.end());
+        }
+        expired.clear();
+
+        // Save new pipelines, throttled to avoid hitting the disk every frame
+        auto now = std::chrono::steady_clock::now();
+        if(m_newPipelines && now - m_lastCacheSave > std::chrono::seconds(10))
+        {
+            m_newPipelines = false;
+            m_lastCacheSave = now;
+            VulkanInitializer::SavePipelineCache(m_context);
         }
     }
 }
\ No newline at end of file
@@ -10,6 +10,9 @@
 
 #include <glm/glm.hpp>
 #include <functional>
+#include <atomic>
+#include <chrono>
+#include <future>
 
 struct GLFWwindow;
 
@@ -156,6 +159,9 @@ namespace ler
         explicit Texture(const VulkanContext& context) : m_context(context) { }
         [[nodiscard]] vk::ImageView view(vk::ImageSubresourceRange subresource = DefaultSub);
         [[nodiscard]] vk::Extent2D extent() const;
+        // Tracked per mip and layer, IResource::state holds the last transition
+        [[nodiscard]] ResourceState getState(uint32_t mipLevel, uint32_t arrayLayer) const;
+        void setState(const vk::ImageSubresourceRange& range, ResourceState newState);
 
         static constexpr vk::ImageSubresourceRange DefaultSub = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
 
@@ -163,6 +169,7 @@ namespace ler
 
         const VulkanContext& m_context;
         std::unordered_map<vk::ImageSubresourceRange, vk::UniqueImageView> m_views;
+        std::vector<ResourceState> m_states;
     };
 
     using TexturePtr = std::shared_ptr<Texture>;
@@ -176,6 +183,7 @@ namespace ler
 
     struct Shader
     {
+        std::string name;
         vk::UniqueShaderModule shaderModule;
         vk::ShaderStageFlagBits stageFlagBits = {};
         vk::PipelineVertexInputStateCreateInfo pvi;
@@ -191,7 +199,11 @@ namespace ler
     {
         std::vector<vk::DescriptorSetLayoutBinding> layoutBinding;
         vk::UniqueDescriptorSetLayout layout;
-        vk::UniqueDescriptorPool pool;
+        // Grown by one pool when the last one is exhausted
+        std::vector<vk::UniqueDescriptorPool> pools;
+        std::vector<vk::DescriptorPoolSize> poolSizes;
+        vk::DescriptorPoolCreateFlags poolFlags;
+        uint32_t dynamicCount = 0;
     };
 
     using PipelineRenderingAttachment = std::vector<vk::Format>;
@@ -238,6 +250,9 @@ namespace ler
         TexturePtr image;
     };
 
+    // Specialization constant id -> raw 32 bits value (use std::bit_cast for float)
+    using SpecConstants = std::map<uint32_t, uint32_t>;
+
     struct PipelineInfo
     {
         vk::Extent2D extent;
@@ -248,7 +263,12 @@ namespace ler
         bool writeDepth = true;
         float lineWidth = 1.f;
         PipelineRenderingAttachment colorAttach;
-        vk::Format depthAttach;
+        vk::Format depthAttach = vk::Format::eUndefined;
+        SpecConstants constants;
+        // Compute only, subgroups are full and sized like the context subgroupSize
+        bool fullSubgroups = false;
+
+        bool operator==(const PipelineInfo&) const = default;
     };
 
     class BasePipeline
@@ -256,19 +276,33 @@ namespace ler
     public:
 
         explicit BasePipeline(const VulkanContext& context) : m_context(context) { }
-        void reflectPipelineLayout(vk::Device device, const std::span<ShaderPtr>& shaders);
+        void reflectPipelineLayout(vk::Device device, const std::span<ShaderPtr>& shaders, uint32_t textureCount = 0);
         vk::DescriptorSet createDescriptorSet(uint32_t set);
+        void freeDescriptorSet(vk::DescriptorSet descriptor);
 
         std::optional<vk::DescriptorType> findBindingType(uint32_t set, uint32_t binding);
+        [[nodiscard]] uint32_t getDynamicCount(uint32_t set) const;
         void updateSampler(vk::DescriptorSet descriptor, uint32_t binding, vk::Sampler sampler, vk::ImageLayout layout, vk::ImageView view);
         void updateSampler(vk::DescriptorSet descriptor, uint32_t binding, vk::Sampler& sampler, const std::span<TexturePtr>& textures);
-        void updateStorage(vk::DescriptorSet descriptor, uint32_t binding, const BufferPtr& buffer, uint64_t byteSize);
+        void updateStorage(vk::DescriptorSet descriptor, uint32_t binding, const BufferPtr& buffer, uint64_t byteSize, uint64_t offset = 0);
+        [[nodiscard]] bool isReady() const;
+        [[nodiscard]] bool hasFailed() const;
+        void wait() const;
 
         vk::UniquePipeline handle;
         vk::UniquePipelineLayout pipelineLayout;
         vk::PipelineBindPoint bindPoint = vk::PipelineBindPoint::eGraphics;
         std::unordered_map<uint32_t,DescriptorAllocator> descriptorAllocMap;
-        std::unordered_map<VkDescriptorSet, uint32_t> descriptorPoolMap;
+        std::unordered_map<VkDescriptorSet, std::pair<uint32_t,vk::DescriptorPool>> descriptorPoolMap;
+        std::vector<vk::PushConstantRange> pushConstants;
+
+        // Sources kept to rebuild the pipeline on shader reload
+        std::vector<ShaderPtr> shaders;
+        PipelineInfo info;
+        // Valid while the driver compiles on the async pool, layout and descriptors are usable meanwhile
+        std::shared_future<void> compilation;
+        // Set when the async build threw, cleared by a successful reload
+        std::atomic<bool> failed = false;
 
     private:
 
@@ -291,12 +325,25 @@ namespace ler
         explicit ComputePipeline(const VulkanContext& context) : BasePipeline(context) { }
     };
 
+    static constexpr uint32_t kMaxFramesInFlight = 3;
+
+    // Command pool owned by one thread for one frame slot, reset as a whole
+    struct CommandFrame
+    {
+        vk::CommandPool pool = vk::CommandPool();
+        std::vector<vk::CommandBuffer> buffers;
+        size_t used = 0;
+        std::atomic<uint32_t> pending = 0;
+        std::atomic<uint64_t> lastSubmissionID = 0;
+    };
+
     class TrackedCommandBuffer
     {
     public:
         // the command buffer itself
         vk::CommandBuffer cmdBuf = vk::CommandBuffer();
-        vk::CommandPool cmdPool = vk::CommandPool();
+        // Shares ownership of the arena, so it stays valid past the queue teardown
+        std::shared_ptr<CommandFrame> frame;
 
         uint64_t submissionID = 0;
         CommandQueue queueKind = CommandQueue::Graphics;
@@ -305,21 +352,42 @@ namespace ler
         ~TrackedCommandBuffer();
         explicit TrackedCommandBuffer(const VulkanContext& context) : m_context(context){ }
 
-        void addImageBarrier(const TexturePtr& texture, ResourceState new_state) const;
-        void addBufferBarrier(const BufferPtr& buffer, ResourceState new_state) const;
-        void addBarrier(const std::shared_ptr<IResource>& resource, ResourceState new_state) const;
+        // Must be called by the recording thread when another thread submits
+        void close();
+        void markSubmitted(uint64_t id);
+
+        // Append transitions from the tracked states and update them, recording is left to the caller.
+        // Read to read transitions are skipped, mips and layers sharing a state are merged in one barrier
+        static void createImageBarriers(const TexturePtr& texture, ResourceState new_state, CommandQueue queue,
+                                        std::vector<vk::ImageMemoryBarrier2>& barriers, const vk::ImageSubresourceRange& range = AllSub);
+        static void createBufferBarrier(const BufferPtr& buffer, ResourceState new_state, CommandQueue queue, std::vector<vk::BufferMemoryBarrier2>& barriers);
+        // Barriers are batched until the next action command, flush before recording on cmdBuf directly
+        void addBarriers(std::span<const vk::ImageMemoryBarrier2> images, std::span<const vk::BufferMemoryBarrier2> buffers);
+        void addImageBarrier(const TexturePtr& texture, ResourceState new_state, const vk::ImageSubresourceRange& range = AllSub);
+        void addBufferBarrier(const BufferPtr& buffer, ResourceState new_state);
+        void addBarrier(const std::shared_ptr<IResource>& resource, ResourceState new_state);
+        void flushBarriers();
         void copyBuffer(BufferPtr& src, BufferPtr& dst, uint64_t byteSize = VK_WHOLE_SIZE, uint64_t dstOffset = 0);
         void copyBuffer(BufferPtr& src, BufferPtr& dst, vk::BufferCopy copy);
         void copyBufferToTexture(const BufferPtr& buffer, const TexturePtr& texture);
-        void bindPipeline(const PipelinePtr& pipeline, vk::DescriptorSet set = nullptr) const;
+        // Dynamic uniform blocks left unspecified are bound at offset 0
+        void bindPipeline(const PipelinePtr& pipeline, vk::DescriptorSet set = nullptr, std::span<const uint32_t> dynamicOffsets = {});
         void executePass(const PassDesc& desc);
         void beginRenderPass(const RenderPass& pass);
-        void draw(uint32_t vertexCount) const;
+        void draw(uint32_t vertexCount);
         void end() const;
 
+        // Aspect is deduced from the texture format
+        static constexpr vk::ImageSubresourceRange AllSub = vk::ImageSubresourceRange({}, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS);
+
     private:
 
+        static bool isRedundant(ResourceState old_state, ResourceState new_state);
+
+        std::vector<vk::ImageMemoryBarrier2> m_imageBarriers;
+        std::vector<vk::BufferMemoryBarrier2> m_bufferBarriers;
         bool m_beginRendering = false;
+        bool m_closed = false;
         const VulkanContext& m_context;
     };
 
@@ -336,6 +404,7 @@ namespace ler
         // creates a command buffer and its synchronization resources
         uint64_t updateLastFinishedID();
         CommandPtr getOrCreateCommandBuffer();
+        void advanceFrame() { m_frameIndex.fetch_add(1, std::memory_order_release); }
 
         void addWaitSemaphore(vk::Semaphore semaphore, uint64_t value);
         void addSignalSemaphore(vk::Semaphore semaphore, uint64_t value);
@@ -347,8 +416,9 @@ namespace ler
         bool pollCommandList(uint64_t submissionID);
         bool waitCommandList(uint64_t submissionID, uint64_t timeout);
 
-        // submission
+        // submission, batched until the next flush
         uint64_t submit(std::vector<CommandPtr>& ppCmd);
+        void flush();
 
         vk::Semaphore trackingSemaphore;
 
@@ -358,9 +428,36 @@ namespace ler
             CommandQueue queueKind = CommandQueue::Graphics;
         };
 
+        struct SubmitStats
+        {
+            uint32_t batchCount = 0;
+            uint32_t commandCount = 0;
+            std::chrono::nanoseconds duration = {};
+        };
+
+        [[nodiscard]] SubmitStats getSubmitStats() const;
+
     private:
 
-        CommandPtr createCommandBuffer();
+        // One VkSubmitInfo2, signals the tracking semaphore with its ID
+        struct SubmitBatch
+        {
+            uint64_t submissionID = 0;
+            bool closed = false;
+            std::vector<vk::SemaphoreSubmitInfo> waits;
+            std::vector<vk::CommandBufferSubmitInfo> commands;
+            std::vector<vk::SemaphoreSubmitInfo> signals;
+        };
+
+        struct CommandArena
+        {
+            std::array<CommandFrame, kMaxFramesInFlight> frames;
+            CommandFrame* current = nullptr;
+            uint64_t frameIndex = UINT64_MAX;
+        };
+
+        std::shared_ptr<CommandArena> getThreadArena();
+        void recycleFrame(CommandFrame& frame);
         void retireCommandBuffers(LerDevice& device);
 
         const VulkanContext& m_context;
@@ -369,21 +466,27 @@ namespace ler
         CommandQueue m_queueKind = CommandQueue::Graphics;
         uint32_t m_queueFamilyIndex = UINT32_MAX;
 
-        std::mutex m_mutex;
-        std::vector<vk::Semaphore> m_waitSemaphores;
-        std::vector<uint64_t> m_waitSemaphoreValues;
-        std::vector<vk::Semaphore> m_signalSemaphores;
-        std::vector<uint64_t> m_signalSemaphoreValues;
+        // Guards arenas, pending semaphores, batches, stats and in flight commands, any thread may submit
+        mutable std::mutex m_mutex;
+        std::vector<vk::SemaphoreSubmitInfo> m_waitSemaphores;
+        std::vector<vk::SemaphoreSubmitInfo> m_signalSemaphores;
+        std::vector<SubmitBatch> m_batches;
+        SubmitStats m_stats;
 
-        uint64_t m_lastSubmittedID = 0;
-        uint64_t m_lastFinishedID = 0;
+        std::atomic<uint64_t> m_lastSubmittedID = 0;
+        std::atomic<uint64_t> m_lastFlushedID = 0;
+        std::atomic<uint64_t> m_lastFinishedID = 0;
 
+        uint64_t m_uid = 0;
+        std::atomic<uint64_t> m_frameIndex = 0;
+        std::vector<std::shared_ptr<CommandArena>> m_arenas;
         std::vector<CommandPtr> m_commandBuffersInFlight;
-        std::vector<CommandPtr> m_commandBuffersPool;
     };
 
     class TexturePool;
     using TexturePoolPtr = std::shared_ptr<TexturePool>;
+    class UploadAllocator;
+    using UploadAllocatorPtr = std::shared_ptr<UploadAllocator>;
 
     enum class RT
     {
@@ -419,10 +522,18 @@ namespace ler
         TexturePoolPtr getTexturePool();
         vk::Format chooseDepthFormat();
 
+        // Transient host data, valid until the current frame slot is reused
+        [[nodiscard]] const UploadAllocatorPtr& getUploadAllocator() const { return m_uploadAllocator; }
+
         // Pipeline
         [[nodiscard]] ShaderPtr createShader(const fs::path& path) const;
         PipelinePtr createGraphicsPipeline(const std::span<ShaderPtr>& shaders, const PipelineInfo& info);
-        PipelinePtr createComputePipeline(const ShaderPtr& shader);
+        PipelinePtr createComputePipeline(const ShaderPtr& shader, const SpecConstants& constants = {}, bool fullSubgroups = false);
+        // Return a pending pipeline, check isReady() before binding it
+        PipelinePtr createGraphicsPipelineAsync(const std::span<ShaderPtr>& shaders, const PipelineInfo& info);
+        PipelinePtr createComputePipelineAsync(const ShaderPtr& shader, const SpecConstants& constants = {}, bool fullSubgroups = false);
+        // Swap pipelines using this shader, the layout must stay the same
+        void rebuildPipelines(const std::string& shaderName);
 
         // DescriptorSet
         void updateSampler(vk::DescriptorSet descriptorSet, uint32_t binding, vk::Sampler& sampler, const std::span<TexturePtr>& textures, vk::DescriptorType type = vk::DescriptorType::eCombinedImageSampler);
@@ -435,12 +546,29 @@ namespace ler
         void queueSubmitSignal(CommandQueue executionQueueID);
         void queueWaitForSemaphore(CommandQueue waitQueueID, vk::Semaphore semaphore, uint64_t value);
         void queueSignalSemaphore(CommandQueue executionQueueID, vk::Semaphore semaphore, uint64_t value);
+        void queueWaitForCommand(CommandQueue waitQueueID, CommandQueue executionQueueID, uint64_t submissionId);
+        [[nodiscard]] bool hasAsyncCompute() const { return m_queues[uint32_t(CommandQueue::Compute)] != nullptr; }
         bool pollCommand(uint64_t submissionId, CommandQueue kind = CommandQueue::Transfer);
         CommandPtr createCommand(CommandQueue kind = CommandQueue::Graphics);
         uint64_t submitCommand(CommandPtr& cmd);
         void submitAndWait(CommandPtr& cmd);
         void submitOneshot(CommandPtr& cmd);
+        void flushCommands();
+        // Blocks until graphics and compute are idle, the transfer queue keeps streaming
+        void waitForRendering();
+        [[nodiscard]] Queue::SubmitStats getSubmitStats(CommandQueue kind = CommandQueue::Graphics) const { return m_queues[uint32_t(kind)]->getSubmitStats(); }
         void runGarbageCollection();
+        // Freed once every queue has finished the work submitted so far (buffers, textures, pipelines, raw handles)
+        void release(std::shared_ptr<void> object);
+        // Shared pipelines outlive their users, sets go back to the pipeline pool
+        void release(const PipelinePtr& pipeline, vk::DescriptorSet descriptor);
+
+        // Frames in flight, beginFrame blocks until the reused slot has retired
+        void setFramesInFlight(uint32_t count);
+        [[nodiscard]] uint32_t getFramesInFlight() const { return m_framesInFlight; }
+        [[nodiscard]] uint32_t getFrameIndex() const { return m_frameIndex; }
+        void beginFrame();
+        void endFrame();
 
         // Utils
         static vk::Viewport createViewport(const vk::Extent2D& extent);
@@ -449,13 +577,81 @@ namespace ler
 
     private:
 
+        static constexpr uint32_t kSmallBufferSize = 1024 * 1024;
+        static constexpr uint64_t kDedicatedTargetSize = 16ull * 1024 * 1024;
+
         static uint32_t formatSize(VkFormat format);
         void populateTexture(const TexturePtr& texture, vk::Format format, const vk::Extent2D& extent, vk::SampleCountFlagBits sampleCount, bool isRenderTarget = false, uint32_t arrayLayers = 1, uint32_t mipLevels = 1);
 
         const VulkanContext& m_context;
         std::array<std::unique_ptr<Queue>, uint32_t(CommandQueue::Count)> m_queues;
+        std::vector<uint32_t> m_sharedQueueFamilies;
         std::vector<TexturePoolPtr> m_texturePools;
+        UploadAllocatorPtr m_uploadAllocator;
         std::array<TexturePtr, uint32_t(RT::eCount)> m_renderTargets;
+        std::atomic_bool m_newPipelines = false;
+        std::chrono::steady_clock::time_point m_lastCacheSave;
+
+        static bool isLayoutCompatible(const BasePipeline& a, const BasePipeline& b);
+        PipelinePtr prepareGraphicsPipeline(const std::span<ShaderPtr>& shaders, const PipelineInfo& info);
+        PipelinePtr prepareComputePipeline(const ShaderPtr& shader, const SpecConstants& constants, bool fullSubgroups);
+        PipelinePtr createGraphicsVariant(const std::span<ShaderPtr>& shaders, const PipelineInfo& info, bool async);
+        PipelinePtr createComputeVariant(const ShaderPtr& shader, const SpecConstants& constants, bool fullSubgroups, bool async);
+        static size_t hashPipeline(const std::span<ShaderPtr>& shaders, const PipelineInfo& info);
+        static size_t hashPipelineInfo(const PipelineInfo& info);
+        void compilePipeline(const PipelinePtr& pipeline, bool async);
+        void buildGraphicsPipeline(BasePipeline& pipeline, bool allowLibrary = true);
+        void linkGraphicsPipeline(BasePipeline& pipeline);
+        vk::Pipeline getPipelineLibrary(vk::GraphicsPipelineLibraryFlagBitsEXT part, const BasePipeline& pipeline);
+        void buildComputePipeline(BasePipeline& pipeline);
+        void registerPipeline(const PipelinePtr& pipeline);
+
+        std::mutex m_pipelineMutex;
+        std::vector<std::weak_ptr<BasePipeline>> m_pipelines;
+        std::map<std::tuple<std::string,SpecConstants,bool>, std::weak_ptr<BasePipeline>> m_computeVariants;
+        std::unordered_multimap<size_t, std::weak_ptr<BasePipeline>> m_graphicsVariants;
+
+        // VK_EXT_graphics_pipeline_library parts, dropped when one of their shaders is reloaded
+        struct LibraryKey
+        {
+            vk::GraphicsPipelineLibraryFlagBitsEXT part = {};
+            std::vector<ShaderPtr> shaders;
+            PipelineInfo info;
+
+            bool operator==(const LibraryKey&) const = default;
+        };
+
+        struct LibraryKeyHash
+        {
+            size_t operator()(const LibraryKey& key) const;
+        };
+
+        std::mutex m_libraryMutex;
+        std::unordered_map<LibraryKey, vk::UniquePipeline, LibraryKeyHash> m_libraries;
+
+        struct ShaderEntry
+        {
+            fs::file_time_type time;
+            uint64_t checksum = 0;
+            std::weak_ptr<Shader> shader;
+        };
+
+        [[nodiscard]] ShaderPtr reflectShader(const fs::path& path, const Blob& bytecode) const;
+
+        mutable std::mutex m_shaderMutex;
+        mutable std::unordered_map<std::string, ShaderEntry> m_shaders;
+
+        struct Release
+        {
+            std::array<uint64_t, uint32_t(CommandQueue::Count)> submissionIDs = {};
+            std::shared_ptr<void> object;
+        };
+
+        std::mutex m_releaseMutex;
+        std::vector<Release> m_releases;
+        uint32_t m_framesInFlight = 2;
+        uint32_t m_frameIndex = 0;
+        std::array<uint64_t, kMaxFramesInFlight> m_frameSubmissions = {};
     };
 
     using LerDevicePtr = std::shared_ptr<LerDevice>;
@@ -478,19 +674,27 @@ namespace ler
         ~TexturePool();
         TexturePool();
 
+        // The file system is captured at fetch time, mount points can change before the read
         struct Resource
         {
-            FsTag tag;
-            uint32_t id;
+            FsTag tag = FsTag_Default;
+            uint32_t id = 0;
             fs::path path;
+            FileSystemPtr fileSystem;
         };
 
         static constexpr uint32_t Size = 300;
         using Future = std::function<void()>;
         using Require = std::bitset<Size>;
-        uint32_t fetch(const fs::path& filename, FsTag tag);
+        uint32_t fetch(const fs::path& filename, FsTag tag, const glm::vec4& bounds = glm::vec4(0.f));
+        // Slots are shared by key (scope and filename), a reloaded scene gets its previous slots back
+        uint32_t fetch(const fs::path& filename, FsTag tag, const FileSystemPtr& fileSystem, const glm::vec4& bounds, std::string_view scope = {});
+        // Drop a request still waiting in the scheduler, the slot falls back on the default texture until fetched again
+        void cancel(uint32_t index);
+        void flush();
 
         void receive(const Queue::CommandCompleteEvent& e);
+        void reload(const FileChangeEvent& e);
         [[nodiscard]] uint32_t getTextureCount() const;
         [[nodiscard]] std::span<TexturePtr> getTextures();
         [[nodiscard]] std::vector<vk::ImageView> getImageViews();
@@ -501,10 +705,15 @@ namespace ler
 
         void init(LerDevice* device) { m_device = device; }
         void set(uint32_t index, const TexturePtr& texture, uint64_t ticket);
+        // Point a slot that could not be loaded at the default texture, so dependent scenes are not blocked
+        void fail(uint32_t index);
+        // Keep replaced textures alive until the given command completes
+        bool retire(const CommandPtr& cmd);
 
     private:
 
         uint32_t allocate();
+        void schedule(uint32_t index, const glm::vec4& bounds, uint64_t byteSize);
 
         LerDevice* m_device;
         Require m_loadedTextures;
@@ -513,8 +722,63 @@ namespace ler
         std::atomic_flag m_fence = ATOMIC_FLAG_INIT;
         std::multimap<uint64_t, uint32_t> m_submitted;
         std::unordered_multimap<std::string, uint32_t> m_cache;
+        std::unordered_map<std::string, uint32_t> m_slots;
+        std::vector<Resource> m_pending;
+        std::vector<uint32_t> m_cancelled;
+        // Guarded by the mutex, scheduler callbacks run on other threads
+        std::array<uint64_t, Size> m_tickets = {};
+        Require m_dropped;
+        std::array<Resource, Size> m_resources;
+        std::vector<TexturePtr> m_retired;
+        std::multimap<uint64_t, std::pair<uint32_t, TexturePtr>> m_reloaded;
+        std::mutex m_mutex;
+
+        static void processImages(LerDevice* device, const Resource& res, const Blob& blob);
+    };
 
-        static void processImages(LerDevice* device, const Resource& res);
+    struct UploadAllocation
+    {
+        vk::Buffer buffer;
+        uint32_t offset = 0;
+        uint32_t size = 0;
+        std::byte* data = nullptr;
+        vk::DeviceAddress address = 0;
+
+        explicit operator bool() const { return data != nullptr; }
+    };
+
+    // One persistently mapped buffer split into a segment per frame slot,
+    // allocations are bumped lock-free and released all at once when the slot is reused
+    class UploadAllocator
+    {
+    public:
+
+        static constexpr uint32_t kDefaultSegmentSize = 1024 * 1024;
+
+        void init(LerDevice* device, uint32_t segmentSize = kDefaultSegmentSize);
+        void beginFrame(uint32_t frameIndex);
+        UploadAllocation allocate(uint32_t byteSize);
+
+        template<typename T>
+        UploadAllocation upload(const T& value)
+        {
+            UploadAllocation alloc = allocate(sizeof(T));
+            if(alloc)
+                std::memcpy(alloc.data, &value, sizeof(T));
+            return alloc;
+        }
+
+        [[nodiscard]] const BufferPtr& getBuffer() const { return m_buffer; }
+        [[nodiscard]] uint32_t getAlignment() const { return m_alignment; }
+
+    private:
+
+        BufferPtr m_buffer;
+        vk::DeviceAddress m_address = 0;
+        uint32_t m_alignment = 256;
+        uint32_t m_segmentSize = 0;
+        uint32_t m_segmentOffset = 0;
+        std::atomic<uint32_t> m_head = 0;
     };
 
     struct SubmitTexture
@@ -524,6 +788,11 @@ namespace ler
         CommandPtr command;
     };
 
+    struct SubmitShader
+    {
+        std::string name;
+    };
+
     /*class BatchedMesh;
     struct SubmitTransfer
     {
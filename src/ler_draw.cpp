@@ -87,11 +87,15 @@ namespace ler
     {
         log::debug("[RenderGraph] Compile");
         samplerGlobal = device->createSampler(vk::SamplerAddressMode::eRepeat, true);
+        m_upload = device->getUploadAllocator();
 
         for(RenderGraphNode& node : m_nodes)
         {
             for(RenderDesc& desc : node.bindings)
             {
+                // Uniform blocks live in the upload allocator, the pass gives their offsets each frame
+                if(desc.type == RS_StorageBuffer && (desc.buffer.usage & vk::BufferUsageFlagBits::eUniformBuffer))
+                    continue;
                 if(desc.type == RS_StorageBuffer)
                 {
                     log::debug("[RenderGraph] Add buf: {:10s} -> {}", desc.name, vk::to_string(desc.buffer.usage));
@@ -105,12 +109,21 @@ namespace ler
                 throw std::runtime_error("RenderGraph Node Not Implemented");
             }
 
+            // Buffer only compute passes overlap graphics, images would need ownership transfers
+            const bool bufferOnly = std::ranges::all_of(node.bindings, [](const RenderDesc& desc){ return desc.type == RS_ReadOnlyBuffer || desc.type == RS_StorageBuffer; });
+            if(node.type == RP_Compute && bufferOnly && device->hasAsyncCompute())
+                node.queue = CommandQueue::Compute;
+
             node.pass->create(device, *this, node.bindings);
             PipelinePtr pipeline = node.pass->getPipeline();
-            node.descriptor = pipeline->createDescriptorSet(0);
-            for(RenderDesc& res : node.bindings)
-                bindResource(pipeline, res, node.descriptor);
+            for(vk::DescriptorSet& descriptor : node.descriptors)
+            {
+                descriptor = pipeline->createDescriptorSet(0);
+                for(RenderDesc& res : node.bindings)
+                    bindResource(pipeline, res, descriptor);
+            }
         }
+        m_dirtySlots = 0;
     }
 
     void RenderGraph::setRenderAttachment(const RenderDesc& desc, vk::RenderingAttachmentInfo& info)
@@ -136,6 +149,8 @@ namespace ler
                 if(desc.type == RS_RenderTarget || desc.type == RS_DepthWrite)
                 {
                     log::debug("[RenderGraph] Add tex: {:10s} -> {}", desc.name, vk::to_string(desc.texture.format));
+                    if(const auto* previous = std::get_if<TexturePtr>(&m_resourceCache[desc.handle]))
+                        device->release(*previous);
                     m_resourceCache[desc.handle] = device->createTexture(desc.texture.format, viewport, vk::SampleCountFlagBits::e1, true);
                 }
             }
@@ -146,7 +161,6 @@ namespace ler
             node.rendering.viewport = viewport;
             node.rendering.colorCount = 0;
             vk::RenderingAttachmentInfo* info;
-            PipelinePtr pipeline = node.pass->getPipeline();
             for(const RenderDesc& desc : node.bindings)
             {
                 switch(desc.type)
@@ -166,64 +180,233 @@ namespace ler
                     default:
                         break;
                 }
-
-                if(pipeline)
-                    bindResource(pipeline, desc, node.descriptor);
             }
         }
+
+        // Frames in flight still read the previous targets through their sets
+        m_dirtySlots = (1u << kMaxFramesInFlight) - 1;
     }
 
-    void RenderGraph::execute(CommandPtr& cmd, TexturePtr& backBuffer, const SceneBuffers& sb, const RenderParams& params)
+    bool RenderGraph::isReady()
     {
-        for(size_t i = 0; i < m_nodes.size(); ++i)
+        // Passes read each other outputs, so nothing is drawn until every pipeline is compiled or failed
+        if(m_ready)
+            return true;
+        m_ready = std::ranges::all_of(m_nodes, [](const RenderGraphNode& node)
         {
-            RenderGraphNode& node = m_nodes[i];
-            vk::DebugUtilsLabelEXT markerInfo;
-            auto& color = Color::Palette[i];
-            memcpy(markerInfo.color, color.data(), sizeof(float) * 4);
-            markerInfo.pLabelName = node.name.c_str();
+            return node.pass && (node.pass->getPipeline()->isReady() || node.pass->getPipeline()->hasFailed());
+        });
+        if(!m_ready)
+            return false;
+        for(const RenderGraphNode& node : m_nodes)
+        {
+            if(node.pass->getPipeline()->hasFailed())
+                log::error("Render graph: pass {} skipped until its shaders are fixed", node.name);
+        }
+        return true;
+    }
 
-            // Begin Pass
-            cmd->cmdBuf.beginDebugUtilsLabelEXT(markerInfo);
+    void RenderGraph::updateDescriptors(uint32_t frameIndex)
+    {
+        // The slot is retired by beginFrame, its sets are no longer in use
+        if((m_dirtySlots & (1u << frameIndex)) == 0)
+            return;
+        m_dirtySlots &= ~(1u << frameIndex);
 
-            // Apply Barrier
+        for(RenderGraphNode& node : m_nodes)
+        {
+            PipelinePtr pipeline = node.pass ? node.pass->getPipeline() : nullptr;
+            if(!pipeline || !node.descriptors[frameIndex])
+                continue;
+            for(RenderDesc& res : node.bindings)
+                bindResource(pipeline, res, node.descriptors[frameIndex]);
+        }
+    }
+
+    void RenderGraph::execute(const LerDevicePtr& device, TexturePtr& backBuffer, const SceneBuffers& sb, const RenderParams& params)
+    {
+        const bool ready = isReady();
+        updateDescriptors(params.frameIndex);
+
+        // Barriers depend on the states left by previous nodes, resolve them up front
+        m_splits.clear();
+        m_barriers.resize(m_nodes.size());
+        std::vector<size_t> lastUse(m_resourceCache.size(), SIZE_MAX);
+        for(size_t i = 0; i < m_nodes.size(); ++i)
+        {
+            RenderGraphNode& node = m_nodes[i];
+            m_barriers[i].images.clear();
+            m_barriers[i].buffers.clear();
             for(RenderDesc& desc : node.bindings)
             {
                 if(desc.name == RT_BackBuffer && node.type == RP_Graphics)
                     node.rendering.colors[desc.binding].setImageView(backBuffer->view());
-                ResourceState state = guessState(desc);
-                applyBarrier(cmd, desc, state);
+                const RenderResource& r = m_resourceCache[desc.handle];
+                if(!std::holds_alternative<BufferPtr>(r) && !std::holds_alternative<TexturePtr>(r))
+                    continue;
+
+                // Split the barrier when other nodes run between the producer and this one,
+                // events only work within a queue, semaphores order the other cases
+                size_t producer = lastUse[desc.handle];
+                lastUse[desc.handle] = i;
+                if(producer == SIZE_MAX || i - producer < 2 || m_nodes[producer].queue != node.queue)
+                {
+                    collectBarrier(desc, guessState(desc), node.queue, m_barriers[i]);
+                    continue;
+                }
+
+                auto it = std::ranges::find_if(m_splits, [&](const SplitBarrier& e){ return e.producer == producer && e.consumer == i; });
+                if(it == m_splits.end())
+                    it = m_splits.insert(m_splits.end(), SplitBarrier{producer, i, {}});
+                collectBarrier(desc, guessState(desc), node.queue, it->barriers);
             }
+        }
+
+        // Read to read dependencies produce no barrier, nothing to signal then
+        std::erase_if(m_splits, [](const SplitBarrier& e){ return e.barriers.images.empty() && e.barriers.buffers.empty(); });
+
+        std::vector<vk::UniqueEvent>& events = m_events[params.frameIndex];
+        while(events.size() < m_splits.size())
+            events.emplace_back(device->getVulkanContext().device.createEventUnique(vk::EventCreateInfo()));
 
-            // Begin Rendering
-            if(node.type == RP_Graphics)
-                cmd->beginRenderPass(node.rendering);
+        // Each node records its own primary, workers and the main thread pull nodes from a shared counter
+        struct RecordJob
+        {
+            std::function<void(size_t)> record;
+            size_t count = 0;
+            std::atomic<size_t> next = 0;
+            std::atomic<size_t> done = 0;
 
-            // Render
-            if(node.pass)
+            void run()
             {
-                cmd->bindPipeline(node.pass->getPipeline(), node.descriptor);
-                node.pass->render(cmd, sb, params);
+                for(size_t i = next++; i < count; i = next++)
+                {
+                    record(i);
+                    if(++done == count)
+                        done.notify_one();
+                }
             }
+        };
 
-            // End Pass
-            if(node.type == RP_Graphics)
-                cmd->cmdBuf.endRendering();
-            cmd->cmdBuf.endDebugUtilsLabelEXT();
+        std::vector<CommandPtr> commands(m_nodes.size());
+        auto job = std::make_shared<RecordJob>();
+        job->count = m_nodes.size();
+        job->record = [&](size_t index)
+        {
+            CommandPtr cmd = device->createCommand(m_nodes[index].queue);
+            recordNode(cmd, index, sb, params, ready);
+            cmd->close();
+            commands[index] = cmd;
+        };
+
+        // Late helpers find no work left, the main thread never waits on queued tasks
+        size_t helpers = job->count > 1 ? std::min<size_t>(job->count - 1, Async::GetPool().get_thread_count()) : 0;
+        for(size_t i = 0; i < helpers; ++i)
+            Async::GetPool().push_task([job](){ job->run(); });
+        job->run();
+        for(size_t done = job->done.load(); done < job->count; done = job->done.load())
+            job->done.wait(done);
+
+        // Nodes sharing a resource across queues are ordered by the latest submission of the other one,
+        // from this frame for producers, from the previous frame for consumers still reading
+        m_submissions.resize(m_nodes.size(), 0);
+        for(size_t i = 0; i < m_nodes.size(); ++i)
+        {
+            const RenderGraphNode& node = m_nodes[i];
+            for(size_t j = 0; j < m_nodes.size(); ++j)
+            {
+                const RenderGraphNode& other = m_nodes[j];
+                if(other.queue == node.queue || m_submissions[j] == 0)
+                    continue;
+                const bool shared = std::ranges::any_of(node.bindings, [&](const RenderDesc& a)
+                {
+                    return std::ranges::any_of(other.bindings, [&](const RenderDesc& b){ return a.handle == b.handle; });
+                });
+                if(shared)
+                    device->queueWaitForCommand(node.queue, other.queue, m_submissions[j]);
+            }
+            m_submissions[i] = device->submitCommand(commands[i]);
         }
     }
 
-    void RenderGraph::onSceneChange(SceneBuffers* scene)
+    void RenderGraph::recordNode(CommandPtr& cmd, size_t index, const SceneBuffers& sb, const RenderParams& params, bool ready)
     {
-        for(RenderGraphNode& node : m_nodes)
+        RenderGraphNode& node = m_nodes[index];
+        vk::DebugUtilsLabelEXT markerInfo;
+        auto& color = Color::Palette[index];
+        memcpy(markerInfo.color, color.data(), sizeof(float) * 4);
+        markerInfo.pLabelName = node.name.c_str();
+
+        // Begin Pass
+        cmd->cmdBuf.beginDebugUtilsLabelEXT(markerInfo);
+        const std::vector<vk::UniqueEvent>& events = m_events[params.frameIndex];
+        std::vector<vk::Event> waitEvents;
+        std::vector<vk::DependencyInfo> waitDependencies;
+        for(size_t i = 0; i < m_splits.size(); ++i)
         {
-            if(node.pass == nullptr)
+            if(m_splits[i].consumer != index)
                 continue;
+            waitEvents.emplace_back(events[i].get());
+            waitDependencies.emplace_back(m_splits[i].barriers.dependency());
+        }
+        if(!waitEvents.empty())
+        {
+            // Events are reset once waited, ready for the next use of this frame slot
+            cmd->cmdBuf.waitEvents2(waitEvents, waitDependencies);
+            for(size_t i = 0; i < m_splits.size(); ++i)
+            {
+                if(m_splits[i].consumer == index)
+                    cmd->cmdBuf.resetEvent2(events[i].get(), m_splits[i].barriers.dstStages());
+            }
+        }
+        cmd->addBarriers(m_barriers[index].images, m_barriers[index].buffers);
 
-            PipelinePtr pipeline = node.pass->getPipeline();
-            for(RenderDesc& res : node.bindings)
-                bindResource(pipeline, res, node.descriptor);
+        // Begin Rendering
+        if(node.type == RP_Graphics)
+            cmd->beginRenderPass(node.rendering);
+
+        // Render, attachments are only cleared while pipelines are pending or broken
+        if(node.pass && ready && node.pass->getPipeline()->isReady())
+        {
+            std::vector<uint32_t> dynamicOffsets = node.pass->uploadConstants(params);
+            cmd->bindPipeline(node.pass->getPipeline(), node.descriptors[params.frameIndex], dynamicOffsets);
+            node.pass->render(cmd, sb, params);
+        }
+
+        // End Pass
+        if(node.type == RP_Graphics)
+            cmd->cmdBuf.endRendering();
+        cmd->flushBarriers();
+        for(size_t i = 0; i < m_splits.size(); ++i)
+        {
+            if(m_splits[i].producer == index)
+                cmd->cmdBuf.setEvent2(events[i].get(), m_splits[i].barriers.dependency());
         }
+        cmd->cmdBuf.endDebugUtilsLabelEXT();
+    }
+
+    vk::DependencyInfo RenderGraph::NodeBarriers::dependency() const
+    {
+        vk::DependencyInfo info;
+        info.setImageMemoryBarriers(images);
+        info.setBufferMemoryBarriers(buffers);
+        return info;
+    }
+
+    vk::PipelineStageFlags2 RenderGraph::NodeBarriers::dstStages() const
+    {
+        vk::PipelineStageFlags2 stages;
+        for(const vk::ImageMemoryBarrier2& barrier : images)
+            stages |= barrier.dstStageMask;
+        for(const vk::BufferMemoryBarrier2& barrier : buffers)
+            stages |= barrier.dstStageMask;
+        return stages;
+    }
+
+    void RenderGraph::onSceneChange(SceneBuffers* scene)
+    {
+        // Sets are rewritten as their frame slot comes back
+        m_dirtySlots = (1u << kMaxFramesInFlight) - 1;
     }
 
     void RenderGraph::addResource(const std::string& name, const RenderResource& res)
@@ -284,19 +467,13 @@ namespace ler
         }
     }
 
-    void RenderGraph::applyBarrier(CommandPtr& cmd, const RenderDesc& desc, ResourceState state)
+    void RenderGraph::collectBarrier(const RenderDesc& desc, ResourceState state, CommandQueue queue, NodeBarriers& barriers)
     {
         RenderResource& r = m_resourceCache[desc.handle];
         if (std::holds_alternative<BufferPtr>(r))
-        {
-            BufferPtr buf = std::get<BufferPtr>(r);
-            cmd->addBufferBarrier(buf, state);
-        }
+            TrackedCommandBuffer::createBufferBarrier(std::get<BufferPtr>(r), state, queue, barriers.buffers);
         else if (std::holds_alternative<TexturePtr>(r))
-        {
-            TexturePtr tex = std::get<TexturePtr>(r);
-            cmd->addImageBarrier(tex, state);
-        }
+            TrackedCommandBuffer::createImageBarriers(std::get<TexturePtr>(r), state, queue, barriers.images);
     }
 
     void RenderGraph::bindResource(const PipelinePtr& pipeline, const RenderDesc& res, vk::DescriptorSet descriptor)
@@ -305,7 +482,11 @@ namespace ler
             return;
 
         RenderResource& r = m_resourceCache[res.handle];
-        if (std::holds_alternative<BufferPtr>(r))
+        if (res.type == RS_StorageBuffer && (res.buffer.usage & vk::BufferUsageFlagBits::eUniformBuffer))
+        {
+            pipeline->updateStorage(descriptor, res.binding, m_upload->getBuffer(), res.buffer.byteSize);
+        }
+        else if (std::holds_alternative<BufferPtr>(r))
         {
             auto& buf = std::get<BufferPtr>(r);
             pipeline->updateStorage(descriptor, res.binding, buf, VK_WHOLE_SIZE);
@@ -394,7 +575,8 @@ namespace ler
     {
         using bu = vk::BufferUsageFlagBits;
         m_instanceBuffer = device->createBuffer(C16Mio, bu::eStorageBuffer);
-        m_staging = device->createBuffer(C16Mio, vk::BufferUsageFlagBits(), true);
+        for(BufferPtr& staging : m_staging)
+            staging = device->createBuffer(C16Mio, vk::BufferUsageFlagBits(), true);
 
         m_sceneBuffers.allocate(device);
         auto cullBuffer = std::array<BufferPtr,2>
@@ -444,15 +626,36 @@ namespace ler
 
     void RenderSceneList::install(flecs::world& world, const LerDevicePtr& device)
     {
-        static constexpr uint32_t kInstSize = sizeof(Instance);
-
         world.observer<CTransform, CMesh, CMaterial>().event(flecs::OnSet).each([&](flecs::entity e, CTransform& t, CMesh& m, CMaterial& mat) {
-            unsigned int instanceId = m_instances.size();
+            unsigned int instanceId;
+            if(e.has<CInstance>())
+                instanceId = e.get<CInstance>()->instanceId;
+            else if(!m_freeInstances.empty())
+            {
+                instanceId = m_freeInstances.back();
+                m_freeInstances.pop_back();
+            }
+            else
+            {
+                instanceId = m_instances.size();
+                m_instances.emplace_back();
+            }
 
-            m_instances.emplace_back(t.model, m.bounds, m.min, m.max, mat.materialId, m.meshIndex);
+            m_instances[instanceId] = Instance(t.model, m.bounds, m.min, m.max, mat.materialId, m.meshIndex);
             e.set<CInstance>({instanceId});
             e.add<dirty>();
-            addAABB(m, t);
+            addAABB(instanceId, m, t);
+        });
+
+        // Removed instances are collapsed to an empty box and recycled
+        world.observer<CInstance>().event(flecs::OnRemove).each([&](flecs::entity e, CInstance& i) {
+            if(i.instanceId >= m_instances.size())
+                return;
+
+            m_instances[i.instanceId] = Instance(glm::mat4(0.f), glm::vec4(0.f), glm::vec3(0.f), glm::vec3(0.f), 0, 0);
+            std::fill_n(m_lines.begin() + i.instanceId * kLinePerBox, kLinePerBox, glm::vec3(0.f));
+            patchInstance(i.instanceId);
+            m_freeInstances.push_back(i.instanceId);
         });
 
         world.observer<CTransform>().event(flecs::OnSet).each([&](flecs::entity e, CTransform& t) {
@@ -460,35 +663,55 @@ namespace ler
         });
 
         world.system<CInstance, dirty>().kind(flecs::OnUpdate).each([&](flecs::entity e, CInstance& i, dirty){
-            uint32_t offset = m_patches.size() * kInstSize;
-            vk::BufferCopy& region = m_patches.emplace_back();
-            region.setSize(kInstSize);
-            region.setSrcOffset(offset);
-            region.setDstOffset(i.instanceId * kInstSize);
-            auto& t = m_instances[i.instanceId];
-            void* data = m_staging->hostInfo.pMappedData;
-            auto* dest = static_cast<std::byte*>(data);
-            std::memcpy(dest+offset, &t, kInstSize);
+            patchInstance(i.instanceId);
         });
 
         world.system().kind(flecs::PostUpdate).iter([&](flecs::iter& it) {
             it.world().remove_all<dirty>();
-            if(m_patches.empty())
+            if(m_dirtyInstances.empty())
                 return;
 
-            CommandPtr cmd = device->createCommand();
-            cmd->cmdBuf.copyBuffer(m_staging->handle, m_instanceBuffer->handle, m_patches);
-            device->submitAndWait(cmd);
-            m_patches.clear();
+            // Staging is per frame, earlier frames may still be copying from theirs
+            BufferPtr& staging = m_staging[m_frameIndex];
+            auto* dest = static_cast<std::byte*>(staging->hostInfo.pMappedData);
+            for(uint32_t instanceId : m_dirtyInstances)
+            {
+                uint32_t offset = m_patches.size() * kInstSize;
+                m_patches.emplace_back(offset, instanceId * kInstSize, kInstSize);
+                std::memcpy(dest + offset, &m_instances[instanceId], kInstSize);
+            }
 
-            cmd = device->createCommand();
+            uint32_t lineOffset = m_patches.size() * kInstSize;
             uint32_t byteSize = m_lines.size()*sizeof(glm::vec3);
-            m_staging->uploadFromMemory(m_lines.data(), byteSize);
-            cmd->copyBuffer(m_staging, m_aabbBuffer, byteSize);
-            device->submitAndWait(cmd);
+            std::memcpy(dest + lineOffset, m_lines.data(), byteSize);
+
+            // Earlier frames on the queue may still read the instances
+            using ps = vk::PipelineStageFlagBits;
+            CommandPtr cmd = device->createCommand();
+            cmd->cmdBuf.pipelineBarrier(ps::eAllCommands, ps::eTransfer, vk::DependencyFlags(), {}, {}, {});
+            cmd->cmdBuf.copyBuffer(staging->handle, m_instanceBuffer->handle, m_patches);
+            cmd->copyBuffer(staging, m_aabbBuffer, vk::BufferCopy(lineOffset, 0, byteSize));
+
+            vk::MemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eVertexAttributeRead);
+            cmd->cmdBuf.pipelineBarrier(ps::eTransfer, ps::eAllCommands, vk::DependencyFlags(), barrier, {}, {});
+            device->submitCommand(cmd);
+
+            m_patches.clear();
+            m_dirtyInstances.clear();
         });
     }
 
+    void RenderSceneList::patchInstance(uint32_t instanceId)
+    {
+        m_dirtyInstances.push_back(instanceId);
+    }
+
+    void RenderSceneList::setFrameIndex(uint32_t frameIndex)
+    {
+        m_frameIndex = frameIndex;
+        m_culling.setFrameIndex(frameIndex);
+    }
+
     void RenderSceneList::sort(const CommandPtr& cmd, const CameraParam& camera, bool prePass)
     {
         m_culling.dispatch(cmd, camera, m_instances.size(), prePass);
@@ -505,6 +728,42 @@ namespace ler
         m_culling.renderDepthPyramid(depth, cmd);
     }
 
+    uint64_t RenderSceneList::cullAsync(const LerDevicePtr& device, CommandPtr& cmd, const TexturePtr& depth, const CameraParam& camera)
+    {
+        if(!device->hasAsyncCompute())
+        {
+            m_culling.renderDepthPyramid(depth, cmd);
+            m_culling.dispatch(cmd, camera, m_instances.size(), false);
+            return 0;
+        }
+
+        // Graphics recorded so far is submitted, compute starts once the depth is released
+        m_culling.releaseDepth(depth, cmd);
+        uint64_t graphicsId = device->submitCommand(cmd);
+        device->queueWaitForCommand(CommandQueue::Compute, CommandQueue::Graphics, graphicsId);
+
+        CommandPtr compute = device->createCommand(CommandQueue::Compute);
+        m_culling.renderDepthPyramid(depth, compute);
+        m_culling.dispatch(compute, camera, m_instances.size(), false);
+        uint64_t computeId = device->submitCommand(compute);
+
+        // Work recorded in the new command overlaps culling until waitCull
+        cmd = device->createCommand();
+        return computeId;
+    }
+
+    void RenderSceneList::waitCull(const LerDevicePtr& device, CommandPtr& cmd, const TexturePtr& depth, uint64_t computeId)
+    {
+        if(computeId == 0)
+            return;
+
+        // Overlapping work goes out first, what follows consumes the culling results
+        device->submitCommand(cmd);
+        device->queueWaitForCommand(CommandQueue::Graphics, CommandQueue::Compute, computeId);
+        cmd = device->createCommand();
+        m_culling.acquireDepth(depth, cmd);
+    }
+
     void RenderSceneList::resize(const LerDevicePtr& device, vk::Extent2D extent)
     {
         m_culling.createDepthPyramid(device, extent);
@@ -518,29 +777,35 @@ namespace ler
         cmd->draw(getLineCount());
     }
 
-    void RenderSceneList::addLine(const glm::vec3& p1, const glm::vec3& p2)
+    void RenderSceneList::addLine(std::vector<glm::vec3>::iterator& it, const glm::vec3& p1, const glm::vec3& p2)
     {
-        m_lines.push_back(p1);
-        m_lines.push_back(p2);
+        *it++ = p1;
+        *it++ = p2;
     }
 
-    void RenderSceneList::addAABB(const CMesh& mesh, const CTransform& transform)
+    void RenderSceneList::addAABB(uint32_t instanceId, const CMesh& mesh, const CTransform& transform)
     {
+        // Each instance owns a fixed slot of lines
+        size_t first = size_t(instanceId) * kLinePerBox;
+        if(m_lines.size() < first + kLinePerBox)
+            m_lines.resize(first + kLinePerBox);
+
+        auto it = m_lines.begin() + static_cast<std::ptrdiff_t>(first);
         auto pts = createBox(mesh, transform);
-        addLine(pts[0], pts[1]);
-        addLine(pts[2], pts[3]);
-        addLine(pts[4], pts[5]);
-        addLine(pts[6], pts[7]);
-
-        addLine(pts[0], pts[2]);
-        addLine(pts[1], pts[3]);
-        addLine(pts[4], pts[6]);
-        addLine(pts[5], pts[7]);
-
-        addLine(pts[0], pts[4]);
-        addLine(pts[1], pts[5]);
-        addLine(pts[2], pts[6]);
-        addLine(pts[3], pts[7]);
+        addLine(it, pts[0], pts[1]);
+        addLine(it, pts[2], pts[3]);
+        addLine(it, pts[4], pts[5]);
+        addLine(it, pts[6], pts[7]);
+
+        addLine(it, pts[0], pts[2]);
+        addLine(it, pts[1], pts[3]);
+        addLine(it, pts[4], pts[6]);
+        addLine(it, pts[5], pts[7]);
+
+        addLine(it, pts[0], pts[4]);
+        addLine(it, pts[1], pts[5]);
+        addLine(it, pts[2], pts[6]);
+        addLine(it, pts[3], pts[7]);
     }
 
     std::array<glm::vec3, 8> RenderSceneList::createBox(const CMesh& mesh, const CTransform& transform)
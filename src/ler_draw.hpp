@@ -26,6 +26,7 @@ namespace ler
     {
         CameraParam camera;
         SceneParam scene;
+        uint32_t frameIndex = 0;
     };
 
     //*********************************************
@@ -112,6 +113,8 @@ namespace ler
         virtual void create(const LerDevicePtr& device, RenderGraph& graph, std::span<RenderDesc> resources) = 0;
         virtual void resize(const LerDevicePtr& device, const vk::Extent2D& viewport) {};
         virtual void render(CommandPtr& cmd, const SceneBuffers& sb, RenderParams params) = 0;
+        // Called before the bind, writes per-frame constants and returns their dynamic offsets
+        virtual std::vector<uint32_t> uploadConstants(const RenderParams& params) { return {}; }
         [[nodiscard]] virtual PipelinePtr getPipeline() const = 0;
         [[nodiscard]] virtual std::string getName() const = 0;
     };
@@ -122,9 +125,11 @@ namespace ler
         std::string name;
         RenderPass rendering;
         RenderPassType type = RP_Graphics;
+        CommandQueue queue = CommandQueue::Graphics;
         std::vector<RenderDesc> bindings;
         RenderGraphPass* pass = nullptr;
-        vk::DescriptorSet descriptor = nullptr;
+        // One set per frame slot, rewritten once that slot is retired
+        std::array<vk::DescriptorSet, kMaxFramesInFlight> descriptors = {};
         std::set<uint32_t> outputs;
         std::vector<RenderGraphNode*> edges;
     };
@@ -137,7 +142,7 @@ namespace ler
         void parse(const fs::path& desc);
         void compile(const LerDevicePtr& device, const vk::Extent2D& viewport);
         void resize(const LerDevicePtr& device, const vk::Extent2D& viewport);
-        void execute(CommandPtr& cmd, TexturePtr& backBuffer, const SceneBuffers& sb, const RenderParams& params);
+        void execute(const LerDevicePtr& device, TexturePtr& backBuffer, const SceneBuffers& sb, const RenderParams& params);
         void onSceneChange(SceneBuffers* scene);
 
         void addResource(const std::string& name, const RenderResource& res);
@@ -173,16 +178,45 @@ namespace ler
 
     private:
 
+        struct NodeBarriers
+        {
+            std::vector<vk::ImageMemoryBarrier2> images;
+            std::vector<vk::BufferMemoryBarrier2> buffers;
+
+            [[nodiscard]] vk::DependencyInfo dependency() const;
+            [[nodiscard]] vk::PipelineStageFlags2 dstStages() const;
+        };
+
+        // Producer signals once written, the consumer waits right before reading
+        struct SplitBarrier
+        {
+            size_t producer = 0;
+            size_t consumer = 0;
+            NodeBarriers barriers;
+        };
+
         RenderGraphInfo m_info;
         std::vector<RenderGraphNode> m_nodes;
         std::vector<RenderResource> m_resourceCache;
         std::unordered_map<std::string,uint32_t> m_resourceMap;
         std::vector<RenderGraphNode*> m_sortedNodes;
+        std::vector<NodeBarriers> m_barriers;
+        std::vector<SplitBarrier> m_splits;
+        std::array<std::vector<vk::UniqueEvent>, kMaxFramesInFlight> m_events;
+        // Last submission of each node, cross queue neighbours wait on it
+        std::vector<uint64_t> m_submissions;
+        // Frame slots whose sets miss the latest resources
+        uint32_t m_dirtySlots = 0;
+        bool m_ready = false;
 
         vk::UniqueSampler samplerGlobal;
+        UploadAllocatorPtr m_upload;
 
+        bool isReady();
+        void updateDescriptors(uint32_t frameIndex);
         void setRenderAttachment(const RenderDesc& desc, vk::RenderingAttachmentInfo& info);
-        void applyBarrier(CommandPtr& cmd, const RenderDesc& desc, ResourceState state);
+        void collectBarrier(const RenderDesc& desc, ResourceState state, CommandQueue queue, NodeBarriers& barriers);
+        void recordNode(CommandPtr& cmd, size_t index, const SceneBuffers& sb, const RenderParams& params, bool ready);
         void bindResource(const PipelinePtr& pipeline, const RenderDesc& desc, vk::DescriptorSet descriptor);
         void computeEdges(RenderGraphNode& node);
         void topologicalSort();
@@ -209,22 +243,33 @@ namespace ler
         void drawAABB(const CommandPtr& cmd);
 
         void generate(const TexturePtr& depth, const CommandPtr& cmd);
+        // HZB and culling on the async compute queue, returns the compute submission graphics must wait on
+        uint64_t cullAsync(const LerDevicePtr& device, CommandPtr& cmd, const TexturePtr& depth, const CameraParam& camera);
+        void waitCull(const LerDevicePtr& device, CommandPtr& cmd, const TexturePtr& depth, uint64_t computeId);
         void resize(const LerDevicePtr& device, vk::Extent2D extent);
+        void setFrameIndex(uint32_t frameIndex);
 
     private:
 
-        void addLine(const glm::vec3& p1, const glm::vec3& p2);
-        void addAABB(const CMesh& mesh, const CTransform& transform);
+        static constexpr uint32_t kLinePerBox = 24;
+        static constexpr uint32_t kInstSize = sizeof(Instance);
+
+        void patchInstance(uint32_t instanceId);
+        static void addLine(std::vector<glm::vec3>::iterator& it, const glm::vec3& p1, const glm::vec3& p2);
+        void addAABB(uint32_t instanceId, const CMesh& mesh, const CTransform& transform);
         static std::array<glm::vec3, 8> createBox(const CMesh& mesh, const CTransform& transform);
 
         InstanceCull m_culling;
+        uint32_t m_frameIndex = 0;
+        std::vector<uint32_t> m_dirtyInstances;
         std::vector<vk::BufferCopy> m_patches;
         std::vector<Instance> m_instances;
+        std::vector<uint32_t> m_freeInstances;
         std::vector<glm::vec3> m_lines;
         SceneBuffers m_sceneBuffers;
         BufferPtr m_instanceBuffer;
         BufferPtr m_aabbBuffer;
-        BufferPtr m_staging;
+        std::array<BufferPtr, kMaxFramesInFlight> m_staging;
     };
 
     class IRenderPass
@@ -100,6 +100,20 @@ namespace ler
 
     void ImGuiPass::render(const LerDevicePtr& device, FrameWindow& frame, RenderSceneList& sceneList, RenderParams& params)
     {
+        // Submissions of the previous frame, one line per queue
+        ImGui::Begin("Submit Stats", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+        static constexpr std::array<const char*, 3> kQueueNames = {"Graphics", "Compute", "Transfer"};
+        for(uint32_t i = 0; i < kQueueNames.size(); ++i)
+        {
+            auto kind = static_cast<CommandQueue>(i);
+            if(kind == CommandQueue::Compute && !device->hasAsyncCompute())
+                continue;
+            const Queue::SubmitStats stats = device->getSubmitStats(kind);
+            ImGui::Text("%s: %u batches, %u commands, %.3f ms", kQueueNames[i], stats.batchCount, stats.commandCount,
+                        std::chrono::duration<double, std::milli>(stats.duration).count());
+        }
+        ImGui::End();
+
         ImGui::Render();
         // Record dear ImGui primitives into command buffer
         ImDrawData* draw_data = ImGui::GetDrawData();
@@ -72,8 +72,16 @@ namespace ler
     {
         const auto ext = fs->format_hint(path);
         if(c_supportedImages.contains(ext) && fs->exists(path))
+            return load(fs->readFile(path), ext);
+
+        log::error("Format not supported: " + ext.string());
+        return {};
+    }
+
+    ImagePtr ImageLoader::load(const Blob& blob, const fs::path& ext)
+    {
+        if(c_supportedImages.contains(ext) && !blob.empty())
         {
-            const Blob& blob = fs->readFile(path);
             if(ext == ".dds" || ext == ".ktx")
                 return std::make_shared<GliImage>(blob);
             else
@@ -70,6 +70,7 @@ namespace ler
     struct ImageLoader
     {
         static ImagePtr load(const FileSystemPtr& fs, const fs::path& path);
+        static ImagePtr load(const Blob& blob, const fs::path& ext);
         static ImagePtr load(const fs::path& path);
         static bool support(const fs::path& path);
     };
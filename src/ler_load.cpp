@@ -0,0 +1,120 @@
+//
+// Created by loulfy on 19/10/2026.
+//
+
+#include "ler_load.hpp"
+
+namespace ler
+{
+    LoadScheduler& LoadScheduler::Get()
+    {
+        static LoadScheduler scheduler;
+        return std::ref(scheduler);
+    }
+
+    LoadScheduler::Ticket LoadScheduler::push(const glm::vec4& bounds, uint64_t byteSize, Task task, Task cancel)
+    {
+        Ticket ticket = m_nextTicket.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard lock(m_mutex);
+        m_requests.emplace_back(ticket, bounds, 0.f, byteSize, std::move(task), std::move(cancel));
+        return ticket;
+    }
+
+    bool LoadScheduler::cancel(Ticket ticket)
+    {
+        Task callback;
+        {
+            std::lock_guard lock(m_mutex);
+            auto it = std::ranges::find(m_requests, ticket, &Request::ticket);
+            if(it == m_requests.end())
+                return false;
+            callback = std::move(it->cancel);
+            m_requests.erase(it);
+        }
+
+        if(callback)
+            callback();
+        return true;
+    }
+
+    size_t LoadScheduler::getPendingCount() const
+    {
+        std::lock_guard lock(m_mutex);
+        return m_requests.size();
+    }
+
+    float LoadScheduler::computePriority(const CameraParam& camera, const glm::vec4& bounds, bool& visible)
+    {
+        visible = true;
+        if(bounds.w <= 0.f)
+            return std::numeric_limits<float>::max();
+
+        const auto center = glm::vec3(bounds);
+        const auto eye = glm::vec3(camera.test);
+        float distance = glm::distance(eye, center);
+        if(distance <= bounds.w)
+            return std::numeric_limits<float>::max();
+
+        // Approximate projected size of the bounding sphere
+        float coverage = std::abs(camera.proj[1][1]) * bounds.w / distance;
+
+        glm::vec4 clip = camera.proj * camera.view * glm::vec4(center, 1.f);
+        visible = false;
+        if(clip.w < -bounds.w)
+            return coverage * 0.1f;
+
+        float margin = bounds.w * std::max(std::abs(camera.proj[0][0]), std::abs(camera.proj[1][1]));
+        if(std::abs(clip.x) - margin > clip.w || std::abs(clip.y) - margin > clip.w)
+            return coverage * 0.25f;
+
+        visible = true;
+
+        return coverage;
+    }
+
+    void LoadScheduler::update(const CameraParam& camera)
+    {
+        std::vector<Request> selected;
+        std::vector<Request> dropped;
+        {
+            std::lock_guard lock(m_mutex);
+            if(m_requests.empty())
+                return;
+
+            for(Request& req : m_requests)
+            {
+                bool visible;
+                req.priority = computePriority(camera, req.bounds, visible);
+                req.hiddenFrames = visible ? 0 : req.hiddenFrames + 1;
+            }
+
+            // Long hidden requests give their budget back, the owner is told and may ask again
+            auto hidden = std::ranges::partition(m_requests, [](const Request& req)
+            {
+                return !req.cancel || req.hiddenFrames < kHiddenFrames;
+            });
+            dropped.assign(std::make_move_iterator(hidden.begin()), std::make_move_iterator(hidden.end()));
+            m_requests.erase(hidden.begin(), hidden.end());
+
+            std::ranges::sort(m_requests, [](const Request& a, const Request& b)
+            {
+                return a.priority > b.priority;
+            });
+
+            // Most relevant first until the bytes of this frame are spent
+            uint64_t byteSize = 0;
+            const uint64_t frameBudget = m_frameBudget.load(std::memory_order_relaxed);
+            auto last = m_requests.begin();
+            while(last != m_requests.end() && (last == m_requests.begin() || byteSize + last->byteSize <= frameBudget))
+                byteSize += (last++)->byteSize;
+
+            selected.assign(std::make_move_iterator(m_requests.begin()), std::make_move_iterator(last));
+            m_requests.erase(m_requests.begin(), last);
+        }
+
+        for(Request& req : dropped)
+            req.cancel();
+        for(Request& req : selected)
+            req.task();
+    }
+}
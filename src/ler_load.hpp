@@ -0,0 +1,58 @@
+//
+// Created by loulfy on 19/10/2026.
+//
+
+#ifndef LER_LOAD_HPP
+#define LER_LOAD_HPP
+
+#include "ler_dev.hpp"
+
+namespace ler
+{
+    class LoadScheduler
+    {
+    public:
+
+        using Task = std::function<void()>;
+        using Ticket = uint64_t;
+
+        static LoadScheduler& Get();
+
+        // Bounds is a world space sphere, a null radius marks a request without location (highest priority).
+        // Byte size is charged to the frame budget, zero when unknown.
+        // Requests with a cancel task are dropped once out of view for kHiddenFrames updates
+        Ticket push(const glm::vec4& bounds, uint64_t byteSize, Task task, Task cancel = {});
+        bool cancel(Ticket ticket);
+
+        // Tasks run on the calling thread and must only start asynchronous work
+        void update(const CameraParam& camera);
+        // At least one request is started per update, even above the budget
+        void setFrameBudget(uint64_t byteSize) { m_frameBudget.store(byteSize, std::memory_order_relaxed); }
+        [[nodiscard]] size_t getPendingCount() const;
+
+    private:
+
+        struct Request
+        {
+            Ticket ticket = 0;
+            glm::vec4 bounds;
+            float priority = 0.f;
+            uint64_t byteSize = 0;
+            Task task;
+            Task cancel;
+            uint32_t hiddenFrames = 0;
+        };
+
+        static constexpr uint32_t kHiddenFrames = 300;
+
+        LoadScheduler() = default;
+        static float computePriority(const CameraParam& camera, const glm::vec4& bounds, bool& visible);
+
+        mutable std::mutex m_mutex;
+        std::vector<Request> m_requests;
+        std::atomic<Ticket> m_nextTicket = 1;
+        std::atomic<uint64_t> m_frameBudget = C32Mio;
+    };
+}
+
+#endif //LER_LOAD_HPP
@@ -8,8 +8,34 @@
 
 namespace ler
 {
+    SceneBuffers::~SceneBuffers()
+    {
+        for(VmaVirtualBlock block : m_blocks)
+        {
+            if(block)
+            {
+                vmaClearVirtualBlock(block);
+                vmaDestroyVirtualBlock(block);
+            }
+        }
+    }
+
     void SceneBuffers::allocate(const LerDevicePtr& device)
     {
+        // Capacities are in elements, offsets feed draw parameters directly
+        static constexpr std::array<VkDeviceSize, Pool_Count> capacities = {
+            kMaxMesh,
+            kMaxBufferSize / sizeof(uint32_t),
+            kMaxBufferSize / sizeof(glm::vec3),
+            kMaxBufferSize / sizeof(Material)
+        };
+        for(size_t i = 0; i < Pool_Count; ++i)
+        {
+            VmaVirtualBlockCreateInfo blockInfo = {};
+            blockInfo.size = capacities[i];
+            vmaCreateVirtualBlock(&blockInfo, &m_blocks[i]);
+        }
+
         m_indexBuffer = device->createBuffer(kMaxBufferSize, vk::BufferUsageFlagBits::eIndexBuffer);
         for(BufferPtr& buf : m_vertexBuffers)
             buf = device->createBuffer(kMaxBufferSize, vk::BufferUsageFlagBits::eVertexBuffer);
@@ -36,6 +62,32 @@ namespace ler
         return m_staticBuffers[1];
     }
 
+    SceneBuffers::Range SceneBuffers::allocate(Pool pool, uint32_t count)
+    {
+        if(count == 0)
+            return {};
+
+        Range range;
+        VkDeviceSize offset = 0;
+        VmaVirtualAllocationCreateInfo allocInfo = {};
+        allocInfo.size = count;
+        std::lock_guard lock(m_mutex);
+        if(vmaVirtualAllocate(m_blocks[pool], &allocInfo, &range.allocation, &offset) != VK_SUCCESS)
+            log::exit("SceneBuffers capacity exceeded");
+        range.offset = static_cast<uint32_t>(offset);
+        range.count = count;
+        return range;
+    }
+
+    void SceneBuffers::release(Pool pool, const Range& range)
+    {
+        if(range.allocation == VK_NULL_HANDLE)
+            return;
+
+        std::lock_guard lock(m_mutex);
+        vmaVirtualFree(m_blocks[pool], range.allocation);
+    }
+
     IndexedMesh SceneBuffers::getMeshInfo(uint32_t meshId) const
     {
         if(meshId < kMaxMesh)
@@ -44,6 +96,7 @@ namespace ler
     }
 
     std::vector<SceneImporter::SceneSubmissionPtr> SceneImporter::m_submissions;
+    std::vector<SceneImporter::SceneSubmissionPtr> SceneImporter::m_scenes;
 
     bool SceneImporter::LoadScene(const LerDevicePtr& device, SceneBuffers& scene, FsTag tag, const fs::path& path)
     {
@@ -54,9 +107,17 @@ namespace ler
         if(list.find(ext.string()) == std::string::npos)
             return false;
 
+        static uint32_t sceneCount = 0;
         SceneSubmissionPtr& submission = m_submissions.emplace_back(std::make_shared<SceneSubmission>());
         submission->scene = &scene;
-        Async::GetPool().push_task(processMeshes, device, tag, path, submission);
+        submission->sceneId = ++sceneCount;
+        submission->tag = tag;
+        submission->path = path;
+        const uint64_t byteSize = FileSystemService::Get(tag)->file_size(path);
+        LoadScheduler::Get().push(glm::vec4(0.f), byteSize, [device, tag, path, submission]()
+        {
+            Async::GetPool().push_task(processMeshes, device, tag, path, submission);
+        });
         return true;
     }
 
@@ -73,6 +134,7 @@ namespace ler
                 it = m_submissions.erase(it);
                 processSceneGraph(sub, world);
                 result.emplace_back(sub->scene);
+                m_scenes.emplace_back(sub);
             }
             else
             {
@@ -83,6 +145,38 @@ namespace ler
         return result;
     }
 
+    bool SceneImporter::ReloadScene(const LerDevicePtr& device, flecs::world& world, const FileChangeEvent& e)
+    {
+        const fs::path path = e.path.lexically_normal();
+        auto it = std::ranges::find_if(m_scenes, [&](const SceneSubmissionPtr& sub)
+        {
+            return sub->path.lexically_normal() == path && FileSystemService::Get(sub->tag) == FileSystemService::Get(e.tag);
+        });
+
+        if(it == m_scenes.end())
+            return false;
+
+        SceneSubmissionPtr sub = *it;
+        m_scenes.erase(it);
+
+        std::vector<flecs::entity> entities;
+        world.each([&](flecs::entity entity, CScene& s)
+        {
+            if(s.sceneId == sub->sceneId)
+                entities.emplace_back(entity);
+        });
+
+        for(flecs::entity& entity : entities)
+            entity.destruct();
+
+        // Give back the buffer ranges, the new import will reuse them
+        for(size_t i = 0; i < SceneBuffers::Pool_Count; ++i)
+            sub->scene->release(SceneBuffers::Pool(i), sub->ranges[i]);
+
+        log::info("Reload scene: {}", sub->path.string());
+        return LoadScene(device, *sub->scene, sub->tag, sub->path);
+    }
+
     void populateBufferCopy(std::byte* dest, vk::BufferCopy& bufferCopy, const aiScene* aiScene,
                             const std::function<bool(aiMesh*)>& predicate,
                             const std::function<void*(aiMesh*)>& provider)
@@ -121,15 +215,26 @@ namespace ler
             return;
         }
 
+        // Scenes import concurrently, textures are read from the file system of their own scene
+        FileSystemPtr textureFs;
+        std::string scope;
         if (aiScene->mNumTextures == 0)
-            FileSystemService::Get().mount(FsTag_Assimp, StdFileSystem::Create(ASSETS_DIR)); //StdFileSystem::Create(path.parent_path()) StdFileSystem::Create(ASSETS_DIR)
+            textureFs = FileSystemService::Get(FsTag_Assets); //StdFileSystem::Create(path.parent_path()) StdFileSystem::Create(ASSETS_DIR)
         else
-            FileSystemService::Get().mount(FsTag_Assimp, AssimpFileSystem::Create(aiScene));
+        {
+            // Embedded names ("*0") only mean something inside their scene
+            textureFs = AssimpFileSystem::Create(aiScene, submission);
+            scope = path.generic_string();
+        }
 
         SceneBuffers* scene = submission->scene;
 
         // Register Meshes
-        uint32_t meshOffset = scene->meshCount.fetch_add(aiScene->mNumMeshes);
+        auto& ranges = submission->ranges;
+        ranges[SceneBuffers::Pool_Mesh] = scene->allocate(SceneBuffers::Pool_Mesh, aiScene->mNumMeshes);
+        ranges[SceneBuffers::Pool_Material] = scene->allocate(SceneBuffers::Pool_Material, aiScene->mNumMaterials);
+        uint32_t meshOffset = ranges[SceneBuffers::Pool_Mesh].offset;
+        uint32_t materialOffset = ranges[SceneBuffers::Pool_Material].offset;
 
         uint32_t indexCount = 0;
         uint32_t vertexCount = 0;
@@ -144,7 +249,7 @@ namespace ler
             info->firstVertex = static_cast<int32_t>(vertexCount);
             info->bMin = glm::make_vec3(&mesh->mAABB.mMin[0]);
             info->bMax = glm::make_vec3(&mesh->mAABB.mMax[0]);
-            info->materialId = mesh->mMaterialIndex;
+            info->materialId = materialOffset + mesh->mMaterialIndex;
             info->name = mesh->mName.C_Str();
 
             indexCount += info->countIndex;
@@ -188,8 +293,10 @@ namespace ler
             info->bounds = calculateMeshBounds(mesh);
         }
 
-        uint32_t indexDstOffset = scene->indexCount.fetch_add(indexCount);
-        uint32_t vertexDstOffset = scene->vertexCount.fetch_add(vertexCount);
+        ranges[SceneBuffers::Pool_Index] = scene->allocate(SceneBuffers::Pool_Index, indexCount);
+        ranges[SceneBuffers::Pool_Vertex] = scene->allocate(SceneBuffers::Pool_Vertex, vertexCount);
+        uint32_t indexDstOffset = ranges[SceneBuffers::Pool_Index].offset;
+        uint32_t vertexDstOffset = ranges[SceneBuffers::Pool_Vertex].offset;
 
         // Register Indirect Mesh (GPU Side)
         std::vector<Meshlet> meshes(aiScene->mNumMeshes);
@@ -204,6 +311,10 @@ namespace ler
             meshes[i].vertexOffset = info->firstVertex;
         }
 
+        // Material bounds drive the streaming priority of their textures
+        std::vector<glm::vec4> bounds(aiScene->mNumMaterials, glm::vec4(0.f));
+        calculateMaterialBounds(aiScene->mRootNode, aiMatrix4x4(), &scene->meshes[meshOffset], materialOffset, bounds);
+
         // Register Material
         aiString filename;
         aiColor3D baseColor;
@@ -213,37 +324,37 @@ namespace ler
         for (size_t i = 0; i < aiScene->mNumMaterials; ++i)
         {
             aiMaterial* material = aiScene->mMaterials[i];
+            const glm::vec4& sphere = bounds[i];
             material->Get(AI_MATKEY_COLOR_DIFFUSE, baseColor);
             materials[i].color = glm::vec3(baseColor.r, baseColor.g, baseColor.b);
             if (material->GetTextureCount(aiTextureType_BASE_COLOR) > 0)
             {
                 material->GetTexture(aiTextureType_BASE_COLOR, 0, &filename);
-                materials[i].texId = pool->fetch(filename.C_Str(), FsTag_Assimp);
+                materials[i].texId = pool->fetch(filename.C_Str(), FsTag_Assimp, textureFs, sphere, scope);
                 key.set(materials[i].texId);
             }
             if (material->GetTextureCount(aiTextureType_AMBIENT) > 0)
             {
                 material->GetTexture(aiTextureType_AMBIENT, 0, &filename);
-                materials[i].texId = pool->fetch(filename.C_Str(), FsTag_Assimp);
+                materials[i].texId = pool->fetch(filename.C_Str(), FsTag_Assimp, textureFs, sphere, scope);
                 key.set(materials[i].texId);
             }
             if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
             {
                 material->GetTexture(aiTextureType_DIFFUSE, 0, &filename);
-                materials[i].texId = pool->fetch(filename.C_Str(), FsTag_Assimp);
+                materials[i].texId = pool->fetch(filename.C_Str(), FsTag_Assimp, textureFs, sphere, scope);
                 key.set(materials[i].texId);
             }
             if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
             {
                 material->GetTexture(aiTextureType_NORMALS, 0, &filename);
-                materials[i].norId = pool->fetch(filename.C_Str(), FsTag_Assimp);
+                materials[i].norId = pool->fetch(filename.C_Str(), FsTag_Assimp, textureFs, sphere, scope);
                 key.set(materials[i].norId);
             }
         }
 
         submission->dependency = key;
 
-        uint32_t materialOffset = scene->materialCount.fetch_add(aiScene->mNumMaterials);
 
         // Merge index
         std::vector<uint32_t> indices;
@@ -338,24 +449,25 @@ namespace ler
         for(size_t i = 0; i < scene->m_staticBuffers.size(); ++i)
             sub.command->copyBuffer(staging, scene->m_staticBuffers[i], copies[i + 5]);
 
+        sub.command->close();
         AsyncQueue<AsyncRequest>::Commit(sub);
     }
 
     void SceneImporter::processSceneGraph(const SceneSubmissionPtr& submission, flecs::world& world)
     {
         const aiScene* aiScene = submission->importer.GetScene();
-        processSceneNode(world, aiScene->mRootNode, 0, submission->scene);
+        processSceneNode(world, aiScene->mRootNode, *submission);
     }
 
-    void SceneImporter::processSceneNode(flecs::world& world, aiNode* aiNode, uint32_t meshOffset, SceneBuffers* scene)
+    void SceneImporter::processSceneNode(flecs::world& world, aiNode* aiNode, const SceneSubmission& submission)
     {
         if(aiNode == nullptr)
             return;
 
         for (size_t i = 0; i < aiNode->mNumMeshes; ++i)
         {
-            uint32_t meshId = aiNode->mMeshes[i]+meshOffset;
-            auto& ind = scene->meshes[meshId];
+            uint32_t meshId = aiNode->mMeshes[i] + submission.ranges[SceneBuffers::Pool_Mesh].offset;
+            auto& ind = submission.scene->meshes[meshId];
             auto node = world.entity();
 
             aiMatrix4x4 model = aiNode->mTransformation;
@@ -374,6 +486,7 @@ namespace ler
             node.set<CMesh>({meshId, min, max, ind->bounds});
             node.set<CTransform>({t});
             node.set<CMaterial>({ind->materialId});
+            node.set<CScene>({submission.sceneId});
 
             min = glm::vec3(t * glm::vec4(min, 1.f));
             max = glm::vec3(t * glm::vec4(max, 1.f));
@@ -386,7 +499,7 @@ namespace ler
         }
 
         for(size_t i = 0; i < aiNode->mNumChildren; ++i)
-            processSceneNode(world, aiNode->mChildren[i], meshOffset, scene);
+            processSceneNode(world, aiNode->mChildren[i], submission);
     }
 
     physx::PxMeshScale PhysicBuilder::create()
@@ -511,4 +624,45 @@ namespace ler
 
         return meshBounds;
     }
-}
\ No newline at end of file
+
+    void SceneImporter::calculateMaterialBounds(const aiNode* aiNode, const aiMatrix4x4& parent, const IndexedMesh* meshes, uint32_t materialOffset, std::vector<glm::vec4>& bounds)
+    {
+        if(aiNode == nullptr)
+            return;
+
+        const aiMatrix4x4 model = parent * aiNode->mTransformation;
+        const auto t = glm::make_mat4(aiMatrix4x4(model).Transpose()[0]);
+        float scale = glm::max(glm::length(glm::vec3(t[0])), glm::max(glm::length(glm::vec3(t[1])), glm::length(glm::vec3(t[2]))));
+
+        for (size_t i = 0; i < aiNode->mNumMeshes; ++i)
+        {
+            const IndexedMesh& info = meshes[aiNode->mMeshes[i]];
+            glm::vec3 center = glm::vec3(t * glm::vec4(glm::vec3(info->bounds), 1.f));
+            float radius = info->bounds.w * scale;
+
+            glm::vec4& sphere = bounds[info->materialId - materialOffset];
+            if(sphere.w <= 0.f)
+            {
+                sphere = glm::vec4(center, radius);
+                continue;
+            }
+
+            // Merge both spheres
+            glm::vec3 dir = center - glm::vec3(sphere);
+            float dist = glm::length(dir);
+            if(dist + radius <= sphere.w)
+                continue;
+            if(dist + sphere.w <= radius)
+            {
+                sphere = glm::vec4(center, radius);
+                continue;
+            }
+            float merged = (dist + radius + sphere.w) * 0.5f;
+            glm::vec3 origin = glm::vec3(sphere) + dir * ((merged - sphere.w) / dist);
+            sphere = glm::vec4(origin, merged);
+        }
+
+        for (size_t i = 0; i < aiNode->mNumChildren; ++i)
+            calculateMaterialBounds(aiNode->mChildren[i], model, meshes, materialOffset, bounds);
+    }
+}
@@ -7,6 +7,7 @@
 
 #include "ler_dev.hpp"
 #include "ler_res.hpp"
+#include "ler_load.hpp"
 
 #include <meshoptimizer.h>
 #include <assimp/Importer.hpp>
@@ -35,9 +36,30 @@ namespace ler
     public:
 
         friend class SceneImporter;
+        ~SceneBuffers();
         void allocate(const LerDevicePtr& device);
         void bind(const CommandPtr& cmd, bool prePass) const;
 
+        enum Pool
+        {
+            Pool_Mesh,
+            Pool_Index,
+            Pool_Vertex,
+            Pool_Material,
+            Pool_Count
+        };
+
+        struct Range
+        {
+            uint32_t offset = 0;
+            uint32_t count = 0;
+            VmaVirtualAllocation allocation = VK_NULL_HANDLE;
+        };
+
+        // Sub-allocated in elements from a VMA virtual block per pool
+        Range allocate(Pool pool, uint32_t count);
+        void release(Pool pool, const Range& range);
+
         static constexpr uint32_t kMaxMesh = 2048;
         static constexpr uint32_t kMaxBufferSize = C64Mio;
         static constexpr uint32_t kShaderGroupSizeNV = 32;
@@ -65,10 +87,9 @@ namespace ler
         std::array<BufferPtr, 2> m_staticBuffers;
 
         std::atomic_uint32_t drawCount = 0;
-        std::atomic_uint32_t meshCount = 0;
-        std::atomic_uint32_t indexCount = 0;
-        std::atomic_uint32_t vertexCount = 0;
-        std::atomic_uint32_t materialCount = 0;
+
+        std::mutex m_mutex;
+        std::array<VmaVirtualBlock, Pool_Count> m_blocks = {};
     };
 
     class PhysicBuilder
@@ -99,23 +120,30 @@ namespace ler
             SceneBuffers* scene = nullptr;
             TexturePool::Require dependency;
             uint64_t submissionId = UINT64_MAX;
+            uint32_t sceneId = 0;
+            FsTag tag = FsTag_Default;
+            fs::path path;
+            std::array<SceneBuffers::Range, SceneBuffers::Pool_Count> ranges;
         };
 
         using SceneSubmissionPtr = std::shared_ptr<SceneSubmission>;
 
         static bool LoadScene(const LerDevicePtr& device, SceneBuffers& scene, FsTag tag, const fs::path& path);
         static std::vector<SceneBuffers*> PollUpdate(const LerDevicePtr& device, flecs::world& world);
+        static bool ReloadScene(const LerDevicePtr& device, flecs::world& world, const FileChangeEvent& e);
 
     protected:
 
         static std::vector<SceneSubmissionPtr> m_submissions;
+        static std::vector<SceneSubmissionPtr> m_scenes;
         static void processMeshes(const LerDevicePtr& device, FsTag tag, const fs::path& path, const SceneSubmissionPtr& submission);
         static void processSceneGraph(const SceneSubmissionPtr& submission, flecs::world& world);
-        static void processSceneNode(flecs::world& world, aiNode* aiNode, uint32_t meshOffset, SceneBuffers* scene);
+        static void processSceneNode(flecs::world& world, aiNode* aiNode, const SceneSubmission& submission);
 
         static void testy(aiMesh* mesh);
         static Meshly buildMeshlet(const meshopt_Meshlet& meshlet, const meshopt_Bounds& bounds);
         static glm::vec4 calculateMeshBounds(aiMesh* mesh);
+        static void calculateMaterialBounds(const aiNode* aiNode, const aiMatrix4x4& parent, const IndexedMesh* meshes, uint32_t materialOffset, std::vector<glm::vec4>& bounds);
     };
 
     struct SubmitScene
@@ -124,7 +152,7 @@ namespace ler
         SceneImporter::SceneSubmissionPtr submission;
     };
 
-    using AsyncRequest = std::variant<SubmitTexture, SubmitScene>;
+    using AsyncRequest = std::variant<SubmitTexture, SubmitScene, SubmitShader>;
 }
 
 #endif //LER_MESH_HPP
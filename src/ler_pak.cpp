@@ -0,0 +1,252 @@
+//
+// Created by loulfy on 19/10/2026.
+//
+
+#include "ler_pak.hpp"
+#include "ler_log.hpp"
+
+#include <zstd.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace ler
+{
+    MappedFile::MappedFile(const fs::path& path)
+    {
+#ifdef _WIN32
+        m_file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(m_file == INVALID_HANDLE_VALUE)
+            log::exit("Failed to open archive: " + path.string());
+
+        LARGE_INTEGER size;
+        GetFileSizeEx(m_file, &size);
+        m_size = static_cast<size_t>(size.QuadPart);
+        if(m_size == 0)
+            return;
+
+        m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(m_mapping == nullptr)
+            log::exit("Failed to map archive: " + path.string());
+        m_data = static_cast<const std::byte*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st = {};
+        if(fd < 0 || fstat(fd, &st) < 0)
+        {
+            if(fd >= 0)
+                close(fd);
+            log::exit("Failed to open archive: " + path.string());
+        }
+
+        m_size = static_cast<size_t>(st.st_size);
+        if(m_size > 0)
+        {
+            void* ptr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(ptr != MAP_FAILED)
+                m_data = static_cast<const std::byte*>(ptr);
+        }
+        close(fd);
+#endif
+        if(m_size > 0 && m_data == nullptr)
+            log::exit("Failed to map archive: " + path.string());
+    }
+
+    MappedFile::~MappedFile()
+    {
+#ifdef _WIN32
+        if(m_data)
+            UnmapViewOfFile(m_data);
+        if(m_mapping)
+            CloseHandle(m_mapping);
+        if(m_file && m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+#else
+        if(m_data)
+            munmap(const_cast<std::byte*>(m_data), m_size);
+#endif
+    }
+
+    PakFileSystem::PakFileSystem(const fs::path& archive) : m_file(archive)
+    {
+        // Only the header is validated, the index is used in place
+        Header header = {};
+        if(m_file.size() < sizeof(Header))
+            log::exit("Invalid archive: " + archive.string());
+        std::memcpy(&header, m_file.data(), sizeof(Header));
+
+        if(header.magic != kMagic || header.version != kVersion)
+            log::exit("Unsupported archive: " + archive.string());
+
+        const uint64_t indexSize = uint64_t(header.count) * sizeof(Entry);
+        if(header.indexOffset % alignof(Entry) || header.indexOffset + indexSize > m_file.size() || header.namesOffset > m_file.size())
+            log::exit("Corrupted archive index: " + archive.string());
+
+        m_entries = {reinterpret_cast<const Entry*>(m_file.data() + header.indexOffset), header.count};
+        m_names = reinterpret_cast<const char*>(m_file.data() + header.namesOffset);
+        log::info("Mount archive: {} ({} files)", archive.string(), header.count);
+    }
+
+    std::string_view PakFileSystem::name(const Entry& entry) const
+    {
+        const auto* end = reinterpret_cast<const char*>(m_file.data() + m_file.size());
+        if(entry.nameOffset + entry.nameSize > static_cast<uint64_t>(end - m_names))
+            return {};
+        return {m_names + entry.nameOffset, entry.nameSize};
+    }
+
+    const PakFileSystem::Entry* PakFileSystem::find(const fs::path& path) const
+    {
+        const std::string key = path.lexically_normal().generic_string();
+        auto it = std::ranges::lower_bound(m_entries, std::string_view(key), {}, [this](const Entry& e){ return name(e); });
+        if(it != m_entries.end() && name(*it) == key)
+            return &(*it);
+        return nullptr;
+    }
+
+    bool PakFileSystem::exists(const fs::path& path) const
+    {
+        return find(path) != nullptr;
+    }
+
+    Blob PakFileSystem::readFile(const fs::path& path)
+    {
+        const Entry* entry = find(path);
+        if(entry == nullptr)
+            throw std::runtime_error("File Not Found: " + path.string());
+        if(entry->offset + entry->size > m_file.size())
+            throw std::runtime_error("Corrupted archive entry: " + path.string());
+
+        const std::byte* src = m_file.data() + entry->offset;
+        Blob result(entry->rawSize);
+        if(entry->codec == Codec_Stored)
+        {
+            std::memcpy(result.data(), src, entry->rawSize);
+            return result;
+        }
+
+        size_t size = ZSTD_decompress(result.data(), result.size(), src, entry->size);
+        if(ZSTD_isError(size) || size != entry->rawSize)
+            throw std::runtime_error("Failed to decompress: " + path.string());
+
+        return result;
+    }
+
+    void PakFileSystem::enumerates(std::vector<fs::path>& entries)
+    {
+        entries.reserve(entries.size() + m_entries.size());
+        for(const Entry& entry : m_entries)
+            entries.emplace_back(name(entry));
+    }
+
+    fs::file_time_type PakFileSystem::last_write_time(const fs::path& path)
+    {
+        const Entry* entry = find(path);
+        if(entry == nullptr)
+            return {};
+        return fs::file_time_type(fs::file_time_type::duration(entry->time));
+    }
+
+    fs::path PakFileSystem::format_hint(const fs::path& path)
+    {
+        return path.extension();
+    }
+
+    uint64_t PakFileSystem::file_size(const fs::path& path)
+    {
+        const Entry* entry = find(path);
+        return entry ? entry->rawSize : 0;
+    }
+
+    bool PakFileSystem::Build(const fs::path& directory, const fs::path& archive, int level)
+    {
+        StdFileSystem source(directory);
+        std::vector<fs::path> files;
+        source.enumerates(files);
+
+        std::vector<std::string> names;
+        names.reserve(files.size());
+        for(const fs::path& file : files)
+            names.emplace_back(file.generic_string());
+        std::ranges::sort(names);
+
+        const fs::path temp = fs::path(archive).concat(".tmp");
+        std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!out)
+        {
+            log::error("Failed to create archive: {}", temp.string());
+            return false;
+        }
+
+        Header header = {kMagic, kVersion, static_cast<uint32_t>(names.size()), 0, 0, 0};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+
+        Blob packed;
+        std::string table;
+        std::vector<Entry> entries;
+        entries.reserve(names.size());
+        for(const std::string& file : names)
+        {
+            const Blob raw = source.readFile(file);
+
+            Entry& entry = entries.emplace_back();
+            entry.nameOffset = table.size();
+            entry.nameSize = static_cast<uint32_t>(file.size());
+            entry.offset = static_cast<uint64_t>(out.tellp());
+            entry.rawSize = raw.size();
+            entry.time = source.last_write_time(file).time_since_epoch().count();
+            table += file;
+
+            // Keep the file stored when compression does not pay off
+            packed.resize(ZSTD_compressBound(raw.size()));
+            size_t size = ZSTD_compress(packed.data(), packed.size(), raw.data(), raw.size(), level);
+            if(!ZSTD_isError(size) && size < raw.size())
+            {
+                entry.codec = Codec_Zstd;
+                entry.size = size;
+                out.write(packed.data(), static_cast<std::streamsize>(size));
+            }
+            else
+            {
+                entry.codec = Codec_Stored;
+                entry.size = raw.size();
+                out.write(raw.data(), static_cast<std::streamsize>(raw.size()));
+            }
+        }
+
+        const std::array<char, alignof(Entry)> padding = {};
+        auto position = static_cast<uint64_t>(out.tellp());
+        out.write(padding.data(), static_cast<std::streamsize>((alignof(Entry) - position % alignof(Entry)) % alignof(Entry)));
+
+        header.indexOffset = static_cast<uint64_t>(out.tellp());
+        out.write(reinterpret_cast<const char*>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(Entry)));
+        header.namesOffset = static_cast<uint64_t>(out.tellp());
+        out.write(table.data(), static_cast<std::streamsize>(table.size()));
+
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        out.close();
+        if(!out)
+        {
+            log::error("Failed to write archive: {}", temp.string());
+            return false;
+        }
+
+        std::error_code ec;
+        fs::rename(temp, archive, ec);
+        if(ec)
+        {
+            log::error("Failed to rename archive: {}", ec.message());
+            return false;
+        }
+
+        log::info("Packed {} files into {}", names.size(), archive.string());
+        return true;
+    }
+}
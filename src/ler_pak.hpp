@@ -0,0 +1,93 @@
+//
+// Created by loulfy on 19/10/2026.
+//
+
+#ifndef LER_PAK_HPP
+#define LER_PAK_HPP
+
+#include "ler_sys.hpp"
+
+namespace ler
+{
+    static const fs::path ASSETS_PAK = fs::path("assets.pak");
+
+    class MappedFile
+    {
+    public:
+
+        explicit MappedFile(const fs::path& path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        [[nodiscard]] const std::byte* data() const { return m_data; }
+        [[nodiscard]] size_t size() const { return m_size; }
+
+    private:
+
+        const std::byte* m_data = nullptr;
+        size_t m_size = 0;
+#ifdef _WIN32
+        void* m_file = nullptr;
+        void* m_mapping = nullptr;
+#endif
+    };
+
+    class PakFileSystem : public FileSystem<PakFileSystem>
+    {
+    public:
+
+        enum Codec : uint32_t
+        {
+            Codec_Stored = 0,
+            Codec_Zstd = 1
+        };
+
+        struct Header
+        {
+            std::array<char, 4> magic;
+            uint32_t version;
+            uint32_t count;
+            uint32_t reserved;
+            uint64_t indexOffset;
+            uint64_t namesOffset;
+        };
+
+        // Index entries are sorted by name
+        struct Entry
+        {
+            uint64_t nameOffset;
+            uint32_t nameSize;
+            uint32_t codec;
+            uint64_t offset;
+            uint64_t size;
+            uint64_t rawSize;
+            int64_t time;
+        };
+
+        static constexpr std::array<char, 4> kMagic = {'L', 'P', 'A', 'K'};
+        static constexpr uint32_t kVersion = 1;
+
+        explicit PakFileSystem(const fs::path& archive);
+        Blob readFile(const fs::path& path) override;
+        [[nodiscard]] bool exists(const fs::path& path) const override;
+        void enumerates(std::vector<fs::path>& entries) override;
+        [[nodiscard]] fs::file_time_type last_write_time(const fs::path& path) override;
+        fs::path format_hint(const fs::path& path) override;
+        [[nodiscard]] uint64_t file_size(const fs::path& path) override;
+
+        static bool Build(const fs::path& directory, const fs::path& archive, int level = 9);
+
+    private:
+
+        [[nodiscard]] const Entry* find(const fs::path& path) const;
+        [[nodiscard]] std::string_view name(const Entry& entry) const;
+
+        MappedFile m_file;
+        std::span<const Entry> m_entries;
+        const char* m_names = nullptr;
+    };
+}
+
+#endif //LER_PAK_HPP
@@ -54,6 +54,15 @@ namespace ler
         return {};
     }
 
+    uint64_t AssimpFileSystem::file_size(const fs::path& path)
+    {
+        // Compressed textures store their byte size in the width
+        const aiTexture* em = aiScene->GetEmbeddedTexture(path.string().c_str());
+        if (em == nullptr)
+            return 0;
+        return em->mHeight == 0 ? em->mWidth : uint64_t(em->mWidth) * em->mHeight * sizeof(aiTexel);
+    }
+
     glm::mat4 convert(aiMatrix4x4t<ai_real> from)
     {
         auto m = glm::make_mat4(from.Transpose()[0]);
@@ -107,28 +116,139 @@ namespace ler
     {
         auto s = Event::GetDispatcher().sink<Queue::CommandCompleteEvent>();
         s.connect<&TexturePool::receive>(this);
+        auto w = Event::GetDispatcher().sink<FileChangeEvent>();
+        w.connect<&TexturePool::reload>(this);
     }
 
     TexturePool::~TexturePool()
     {
+        // Scheduled requests capture the pool
+        for(uint32_t i = 0; i < m_textureCount; ++i)
+            cancel(i);
+
         auto s = Event::GetDispatcher().sink<Queue::CommandCompleteEvent>();
         s.disconnect<&TexturePool::receive>(this);
+        auto w = Event::GetDispatcher().sink<FileChangeEvent>();
+        w.disconnect<&TexturePool::reload>(this);
+    }
+
+    uint32_t TexturePool::fetch(const fs::path& filename, FsTag tag, const glm::vec4& bounds)
+    {
+        return fetch(filename, tag, FileSystemService::Get(tag), bounds);
     }
 
-    uint32_t TexturePool::fetch(const fs::path& filename, FsTag tag)
+    uint32_t TexturePool::fetch(const fs::path& filename, FsTag tag, const FileSystemPtr& fileSystem, const glm::vec4& bounds, std::string_view scope)
     {
-        const fs::path ext = FileSystemService::Get(tag)->format_hint(filename);
+        const fs::path ext = fileSystem->format_hint(filename);
         if(ImageLoader::support(ext))
         {
+            std::string key(scope);
+            key += '|';
+            key += filename.generic_string();
+
+            const uint64_t byteSize = fileSystem->file_size(filename);
+            std::unique_lock lock(m_mutex);
+            auto it = m_slots.find(key);
+            if(it != m_slots.end())
+            {
+                const uint32_t index = it->second;
+                const bool moved = m_resources[index].fileSystem != fileSystem;
+                m_resources[index].fileSystem = fileSystem;
+
+                // Dropped by the scheduler, the slot shows the default texture until loaded again
+                if(m_dropped.test(index))
+                {
+                    m_dropped.reset(index);
+                    schedule(index, bounds, byteSize);
+                    return index;
+                }
+                if(!moved)
+                    return index;
+
+                // Queued loads pick up the latest file system, a slot already on the GPU is read again
+                const Resource res = m_resources[index];
+                lock.unlock();
+                if(m_loadedTextures.test(index))
+                {
+                    log::info("Reload texture: {}", res.path.string());
+                    fileSystem->readFileAsync(res.path, [device = m_device, res](Blob&& blob)
+                    {
+                        processImages(device, res, blob);
+                    });
+                }
+                return index;
+            }
+
             uint32_t index = allocate();
-            Resource res(tag, index, filename);
-            Async::GetPool().push_task(processImages, m_device, std::move(res));
+            m_slots.emplace(std::move(key), index);
+            m_resources[index] = Resource(tag, index, filename, fileSystem);
+            schedule(index, bounds, byteSize);
             return index;
         }
 
         return 0;
     }
 
+    void TexturePool::schedule(uint32_t index, const glm::vec4& bounds, uint64_t byteSize)
+    {
+        // Called under the pool lock, the callbacks take it again once the scheduler runs them
+        m_tickets[index] = LoadScheduler::Get().push(bounds, byteSize, [this, index]()
+        {
+            std::lock_guard lock(m_mutex);
+            m_tickets[index] = 0;
+            m_pending.emplace_back(m_resources[index]);
+        }, [this, index]()
+        {
+            // May run on any thread, applied by the next flush
+            std::lock_guard lock(m_mutex);
+            m_tickets[index] = 0;
+            m_dropped.set(index);
+            m_cancelled.emplace_back(index);
+        });
+    }
+
+    void TexturePool::cancel(uint32_t index)
+    {
+        if(index >= Size)
+            return;
+
+        // The cancel callback locks the pool too
+        std::unique_lock lock(m_mutex);
+        const uint64_t ticket = std::exchange(m_tickets[index], 0);
+        lock.unlock();
+        if(ticket != 0)
+            LoadScheduler::Get().cancel(ticket);
+    }
+
+    void TexturePool::flush()
+    {
+        std::vector<Resource> pending;
+        std::vector<uint32_t> cancelled;
+        {
+            std::lock_guard lock(m_mutex);
+            pending.swap(m_pending);
+            cancelled.swap(m_cancelled);
+        }
+
+        for(uint32_t index : cancelled)
+            fail(index);
+
+        // Submit every read of the same file system as a single batch
+        std::map<FileSystemPtr, std::vector<ReadRequest>> batches;
+        for(Resource& res : pending)
+        {
+            fs::path path = res.path;
+            FileSystemPtr fileSystem = res.fileSystem;
+            batches[fileSystem].emplace_back(path, [device = m_device, res = std::move(res)](Blob&& blob)
+            {
+                processImages(device, res, blob);
+            });
+        }
+
+        for(auto& [fileSystem, requests] : batches)
+            fileSystem->readBatchAsync(std::move(requests));
+    }
+
     uint32_t TexturePool::allocate()
     {
         if(m_textureCount == Size)
@@ -143,6 +263,48 @@ namespace ler
             m_loadedTextures.set(i->second);
 
         m_submitted.erase(e.submissionId);
+
+        auto reloaded = m_reloaded.equal_range(e.submissionId);
+        for (auto i = reloaded.first; i != reloaded.second; ++i)
+        {
+            auto& [index, texture] = i->second;
+            m_retired.emplace_back(m_textures[index]);
+            m_textures[index] = texture;
+        }
+
+        m_reloaded.erase(e.submissionId);
+    }
+
+    void TexturePool::reload(const FileChangeEvent& e)
+    {
+        const fs::path path = e.path.lexically_normal();
+        for(uint32_t i = 0; i < m_textureCount; ++i)
+        {
+            std::unique_lock lock(m_mutex);
+            const Resource res = m_resources[i];
+            lock.unlock();
+            if(!m_loadedTextures.test(i) || res.path.lexically_normal() != path)
+                continue;
+            if(res.fileSystem != FileSystemService::Get(e.tag))
+                continue;
+
+            // Upload again into the same slot
+            log::info("Reload texture: {}", path.string());
+            res.fileSystem->readFileAsync(res.path, [device = m_device, res](Blob&& blob)
+            {
+                processImages(device, res, blob);
+            });
+        }
+    }
+
+    bool TexturePool::retire(const CommandPtr& cmd)
+    {
+        if(m_retired.empty())
+            return false;
+
+        cmd->referencedResources.insert(cmd->referencedResources.end(), m_retired.begin(), m_retired.end());
+        m_retired.clear();
+        return true;
     }
 
     uint32_t TexturePool::getTextureCount() const
@@ -183,15 +345,41 @@ namespace ler
     {
         if (m_textures.size() > index && texture)
         {
+            // Reloaded textures are swapped once their upload is complete
+            if(m_textures[index])
+            {
+                m_reloaded.emplace(ticket, std::make_pair(index, texture));
+                return;
+            }
+
             m_textures[index] = texture;
             m_cache.emplace(texture->name, index);
             m_submitted.emplace(ticket, index);
         }
     }
 
-    void TexturePool::processImages(LerDevice* device, const Resource& res)
+    void TexturePool::fail(uint32_t index)
+    {
+        // A reloaded texture keeps its previous content
+        if(index >= Size || (m_textures[index] && m_loadedTextures.test(index)))
+            return;
+        if(m_textures[0])
+            m_textures[index] = m_textures[0];
+        m_loadedTextures.set(index);
+    }
+
+    void TexturePool::processImages(LerDevice* device, const Resource& res, const Blob& blob)
     {
-        ImagePtr img = ImageLoader::load(FileSystemService::Get(res.tag), res.path);
+        ImagePtr img = ImageLoader::load(blob, res.fileSystem->format_hint(res.path));
+        if(!img)
+        {
+            // Reported without texture, the pool falls back on the default one
+            log::error("Failed to load image: {}", res.path.string());
+            SubmitTexture failed;
+            failed.id = res.id;
+            AsyncQueue<AsyncRequest>::Commit(failed);
+            return;
+        }
 
         vk::Extent2D extent = img->extent();
         size_t imageSize = img->byteSize();
@@ -202,6 +390,7 @@ namespace ler
 
         CommandPtr cmd = device->createCommand(CommandQueue::Transfer);
         cmd->copyBufferToTexture(staging, texture);
+        cmd->close();
 
         SubmitTexture submit;
         submit.id = res.id;
@@ -44,17 +44,20 @@ namespace ler
     {
     public:
 
-        explicit AssimpFileSystem(const aiScene* scene) : aiScene(scene) {}
+        // The owner keeps the importer alive while reads are pending
+        AssimpFileSystem(const aiScene* scene, std::shared_ptr<void> owner) : aiScene(scene), m_owner(std::move(owner)) {}
         Blob readFile(const fs::path& path) override;
         [[nodiscard]] bool exists(const fs::path& path) const override;
         void enumerates(std::vector<fs::path>& entries) override;
         [[nodiscard]] fs::file_time_type last_write_time(const fs::path& path) override;
         fs::path format_hint(const fs::path& path) override;
-        static std::shared_ptr<IFileSystem> Create(const aiScene* scene) { return std::make_shared<AssimpFileSystem>(scene); }
+        [[nodiscard]] uint64_t file_size(const fs::path& path) override;
+        static std::shared_ptr<IFileSystem> Create(const aiScene* scene, std::shared_ptr<void> owner) { return std::make_shared<AssimpFileSystem>(scene, std::move(owner)); }
 
     private:
 
         const aiScene* aiScene = nullptr;
+        std::shared_ptr<void> m_owner;
     };
 
     physx::PxMeshScale convertToPxScale(const aiMatrix4x4& aiMatrix);
@@ -119,6 +122,11 @@ namespace ler
 
     };
 
+    struct CScene
+    {
+        glm::uint sceneId = 0;
+    };
+
     struct CPhysic
     {
         physx::PxRigidActor* actor;
@@ -55,7 +55,7 @@ namespace ler
     }
 
     SwapChain
-    SwapChain::create(const VulkanContext& context, vk::SurfaceKHR surface, uint32_t width, uint32_t height, bool vSync)
+    SwapChain::create(const VulkanContext& context, vk::SurfaceKHR surface, uint32_t width, uint32_t height, bool vSync, vk::SwapchainKHR oldSwapChain)
     {
         // Setup viewports, vSync
         std::vector<vk::SurfaceFormatKHR> surfaceFormats = context.physicalDevice.getSurfaceFormatsKHR(surface);
@@ -83,6 +83,7 @@ namespace ler
         createInfo.setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque);
         createInfo.setPresentMode(presentMode);
         createInfo.setClipped(true);
+        createInfo.setOldSwapchain(oldSwapChain);
 
         log::info("SwapChain: Images({}), Extent({}x{}), Format({}), Present({})",
             backBufferCount,
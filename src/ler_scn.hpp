@@ -15,7 +15,7 @@ namespace ler
         vk::Format format = vk::Format::eB8G8R8A8Unorm;
         vk::Extent2D extent;
 
-        static SwapChain create(const VulkanContext& context, vk::SurfaceKHR surface, uint32_t width, uint32_t height, bool vSync);
+        static SwapChain create(const VulkanContext& context, vk::SurfaceKHR surface, uint32_t width, uint32_t height, bool vSync, vk::SwapchainKHR oldSwapChain = {});
         static vk::PresentModeKHR chooseSwapPresentMode(const std::vector<vk::PresentModeKHR>& availablePresentModes, bool vSync);
         static vk::Extent2D chooseSwapExtent(const vk::SurfaceCapabilitiesKHR& capabilities, uint32_t width, uint32_t height);
         static vk::SurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<vk::SurfaceFormatKHR>& availableFormats);
@@ -4,11 +4,15 @@
 
 #include "ler_spv.hpp"
 #include "ler_log.hpp"
+#include "ler_cache.hpp"
 
 #include <glslang/Public/ResourceLimits.h>
 #include <glslang/Public/ShaderLang.h>
 #include <SPIRV/GlslangToSpv.h>
 #include <SPIRV/doc.h>
+#include <spirv-tools/optimizer.hpp>
+
+#include <chrono>
 
 namespace ler
 {
@@ -33,26 +37,75 @@ namespace ler
         return {};
     }
 
-    void DirStackFileIncluder::addInclude(const std::string& include)
+    DirStackFileIncluder::Content DirStackFileIncluder::addInclude(const std::string& include)
+    {
+        Content content;
+        try
+        {
+            content = std::make_shared<const Blob>(FileSystemService::Get().readFile(FsTag_Assets, include));
+        }
+        catch(const std::exception& e)
+        {
+            log::error("Include not found: {}", include);
+            return nullptr;
+        }
+
+        std::unique_lock lock(m_mutex);
+        auto [it, inserted] = m_includes.try_emplace(include, std::move(content));
+        return it->second;
+    }
+
+    bool DirStackFileIncluder::reload(const std::string& include)
+    {
+        // A compile task may still read the old content, its results keep it alive
+        std::unique_lock lock(m_mutex);
+        return m_includes.erase(include) > 0;
+    }
+
+    std::vector<std::string> DirStackFileIncluder::getIncludes()
     {
-        IncludePack pack;
-        pack.binary = FileSystemService::Get().readFile(FsTag_Assets, include);
-        pack.result = std::make_unique<IncludeResult>(include, pack.binary.data(), pack.binary.size(), nullptr);
-        m_includes.emplace(include, std::move(pack));
+        std::shared_lock lock(m_mutex);
+        std::vector<std::string> includes;
+        includes.reserve(m_includes.size());
+        for(const auto& include : m_includes)
+            includes.emplace_back(include.first);
+        return includes;
+    }
+
+    DirStackFileIncluder::IncludeResult* DirStackFileIncluder::findInclude(const char* include)
+    {
+        Content content;
+        {
+            std::shared_lock lock(m_mutex);
+            auto it = m_includes.find(include);
+            if(it != m_includes.end())
+                content = it->second;
+        }
+
+        // First use from any compile thread
+        if(!content)
+            content = addInclude(include);
+        if(!content)
+            return nullptr;
+        return new IncludeResult(include, content->data(), content->size(), new Content(content));
+    }
+
+    void DirStackFileIncluder::releaseInclude(IncludeResult* result)
+    {
+        if(result == nullptr)
+            return;
+        delete static_cast<Content*>(result->userData);
+        delete result;
     }
 
     DirStackFileIncluder::IncludeResult* DirStackFileIncluder::includeSystem(const char* include, const char* shader, size_t size)
     {
-        if(m_includes.contains(include))
-            return m_includes[include].result.get();
-        return nullptr;
+        return findInclude(include);
     }
 
     DirStackFileIncluder::IncludeResult* DirStackFileIncluder::includeLocal(const char* include, const char* shader, size_t size)
     {
-        if(m_includes.contains(include))
-            return m_includes[include].result.get();
-        return nullptr;
+        return findInclude(include);
     }
 
     GlslangInitializer::GlslangInitializer()
@@ -94,6 +147,92 @@ namespace ler
         return shader->parse(GetDefaultResources(), 460, false, controls, Includer());
     }
 
+    static std::atomic_bool s_releaseMode = false;
+
+    void GlslangInitializer::setReleaseMode(bool release)
+    {
+        s_releaseMode = release;
+    }
+
+    bool GlslangInitializer::isReleaseMode()
+    {
+        return s_releaseMode;
+    }
+
+    static EShMessages getControls()
+    {
+        EShMessages controls = EShMsgCascadingErrors;
+        if(!s_releaseMode)
+            controls = static_cast<EShMessages>(controls | EShMsgDebugInfo);
+        controls = static_cast<EShMessages>(controls | EShMsgSpvRules);
+        controls = static_cast<EShMessages>(controls | EShMsgKeepUncalled);
+        controls = static_cast<EShMessages>(controls | EShMsgVulkanRules | EShMsgSpvRules);
+        return controls;
+    }
+
+    static void setupShader(glslang::TShader& shader, const KindMapping& stage)
+    {
+        shader.setEnvTarget(glslang::EShTargetLanguage::EShTargetSpv, glslang::EShTargetLanguageVersion::EShTargetSpv_1_6);
+        if(stage.ext == ".test")
+            shader.setEnvInput(glslang::EShSourceHlsl, stage.kind, glslang::EShClientVulkan, 360);
+    }
+
+    std::string GlslangInitializer::getOptions()
+    {
+        // Everything besides the source that changes the generated SPIR-V
+        const glslang::Version version = glslang::GetVersion();
+        std::string str = "glslang=" + std::to_string(version.major) + "." + std::to_string(version.minor) + "." + std::to_string(version.patch);
+        str += version.flavor;
+        str += ";target=spv1.6;client=vulkan;version=460;entry=main";
+        str += ";controls=" + std::to_string(static_cast<int>(getControls()));
+        str += s_releaseMode ? ";mode=release" : ";mode=debug";
+        return str;
+    }
+
+    std::vector<uint32_t> GlslangInitializer::optimize(const std::vector<uint32_t>& spv, const std::string& name)
+    {
+        spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_3);
+        optimizer.SetMessageConsumer([&name](spv_message_level_t level, const char*, const spv_position_t& pos, const char* message)
+        {
+            if(level <= SPV_MSG_ERROR)
+                log::error("Optimize {}:{} {}", name, pos.index, message);
+        });
+
+        // OpName is kept, vertex inputs are bound by name at reflection
+        optimizer.RegisterPass(spvtools::CreateStripNonSemanticInfoPass());
+        optimizer.RegisterPerformancePasses();
+
+        std::vector<uint32_t> optimized;
+        if(!optimizer.Run(spv.data(), spv.size(), &optimized))
+        {
+            log::warn("Optimize {} failed, keep unoptimized SPIR-V", name);
+            return spv;
+        }
+        return optimized;
+    }
+
+    std::string GlslangInitializer::preprocess(const std::string& code, const fs::path& name)
+    {
+        auto stage = convertShaderExtension(name.extension());
+        if(!stage.has_value())
+            return {};
+
+        glslang::TShader shader(stage.value().kind);
+        setupShader(shader, stage.value());
+        const char* shaderStrings = code.data();
+        const int shaderLengths = static_cast<int>(code.size());
+        shader.setStringsWithLengths(&shaderStrings, &shaderLengths, 1);
+        shader.setEntryPoint("main");
+
+        std::string output;
+        if(!shader.preprocess(GetDefaultResources(), 460, ENoProfile, false, false, getControls(), &output, Includer()))
+        {
+            log::error(shader.getInfoLog());
+            return {};
+        }
+        return output;
+    }
+
     std::vector<uint32_t> GlslangInitializer::compileGlslToSpv(const std::string& code, const fs::path& name)
     {
         auto stage = convertShaderExtension(name.extension());
@@ -102,14 +241,8 @@ namespace ler
 
         bool success = true;
         glslang::TShader shader(stage.value().kind);
-        EShMessages controls = EShMsgCascadingErrors;
-        controls = static_cast<EShMessages>(controls | EShMsgDebugInfo);
-        controls = static_cast<EShMessages>(controls | EShMsgSpvRules);
-        controls = static_cast<EShMessages>(controls | EShMsgKeepUncalled);
-        controls = static_cast<EShMessages>(controls | EShMsgVulkanRules | EShMsgSpvRules);
-        shader.setEnvTarget(glslang::EShTargetLanguage::EShTargetSpv, glslang::EShTargetLanguageVersion::EShTargetSpv_1_6);
-        if(stage.value().ext == ".test")
-            shader.setEnvInput(glslang::EShSourceHlsl, stage.value().kind, glslang::EShClientVulkan, 360);
+        EShMessages controls = getControls();
+        setupShader(shader, stage.value());
         success &= compile(&shader, code, controls, name.string());
 
         if(!success)
@@ -132,52 +265,121 @@ namespace ler
         glslang::SpvOptions options;
         spv::SpvBuildLogger logger;
         std::vector<uint32_t> spv;
-        //options.disableOptimizer = false;
-        //options.optimizeSize = true;
         options.stripDebugInfo = false;
-        options.emitNonSemanticShaderDebugInfo = true;
-        options.emitNonSemanticShaderDebugSource = true;
+        options.emitNonSemanticShaderDebugInfo = !s_releaseMode;
+        options.emitNonSemanticShaderDebugSource = !s_releaseMode;
         glslang::GlslangToSpv(*program.getIntermediate(shader.getStage()), spv, &logger, &options);
         if(!logger.getAllMessages().empty())
             log::error(logger.getAllMessages());
+
+        if(s_releaseMode && !spv.empty())
+            return optimize(spv, name.string());
         return spv;
     }
 
-    void GlslangInitializer::compileFile(const fs::path& input, const fs::path& output)
+    bool GlslangInitializer::compileFile(const fs::path& input, const std::string& output)
     {
         const auto blob = FileSystemService::Get().readFile(FsTag_Assets, input);
         std::string src(blob.begin(), blob.end());
 
-        auto spv = compileGlslToSpv(src, input.filename().string());
+        // Preprocessing expands includes, so any change in a header invalidates the key
+        std::string expanded = preprocess(src, input.filename());
+        if(expanded.empty())
+            return false;
 
-        if(spv.empty())
-            return;
+        auto& cache = CacheService::Get();
+        auto key = CacheKey(kShaderCacheVersion).add(expanded).add(getOptions()).add(input.filename().string()).get();
+        if(!cache.contains(key))
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto spv = compileGlslToSpv(src, input.filename().string());
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            log::warn("Compile {} ({} ms)", output, elapsed.count());
+            if(spv.empty())
+                return false;
 
-        std::ofstream fout(output, std::ios_base::binary);
-        auto size = static_cast<std::streamsize>(spv.size() * sizeof(uint32_t));
-        fout.write(reinterpret_cast<const char*>(spv.data()), size);
-        fout.close();
+            auto size = spv.size() * sizeof(uint32_t);
+            if(!cache.store(key, std::span(reinterpret_cast<const char*>(spv.data()), size)))
+                return false;
+        }
+
+        cache.alias(output, key);
+        return true;
     }
 
     void GlslangInitializer::shaderAutoCompile()
     {
-        fs::create_directory(CACHED_DIR);
+        auto start = std::chrono::steady_clock::now();
         auto& fs = FileSystemService::Get();
         std::vector<fs::path> entries;
         fs.enumerates(FsTag_Assets, entries);
+
+        // One TShader/TProgram per task, the includer is shared
+        std::vector<std::pair<std::string,std::future<bool>>> tasks;
         for(const auto& entry : entries)
         {
             auto res = convertShaderExtension(entry.extension());
             if(!res.has_value())
                 continue;
 
-            fs::path f = CACHED_DIR / entry.filename();
-            f.concat(".spv");
-            if(fs::exists(f) && fs::last_write_time(f) > fs.last_write_time(FsTag_Assets, entry))
-                continue;
+            std::string name = entry.filename().string() + ".spv";
+            tasks.emplace_back(name, Async::GetPool().submit([entry, name](){ return compileFile(entry, name); }));
+        }
+
+        size_t failed = 0;
+        for(auto& [name, task] : tasks)
+        {
+            try
+            {
+                if(!task.get())
+                    failed += 1;
+            }
+            catch(const std::exception& e)
+            {
+                log::error("Failed to compile {}: {}", name, e.what());
+                failed += 1;
+            }
+        }
+
+        CacheService::Get().flush();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        log::info("Shader compilation: {} shaders, {} failed, {} ms", tasks.size(), failed, elapsed.count());
+    }
 
-            log::warn("Compile {}", f.make_preferred().string());
-            compileFile(entry, f);
+    void GlslangInitializer::reloadAsync(const fs::path& path, const ReloadCallback& callback)
+    {
+        std::vector<fs::path> sources;
+        if(convertShaderExtension(path.extension()).has_value())
+        {
+            sources.emplace_back(path);
+        }
+        else if(Includer().reload(path.generic_string()))
+        {
+            // Header changed, the cache keys tell which shaders really depend on it
+            std::vector<fs::path> entries;
+            FileSystemService::Get().enumerates(FsTag_Assets, entries);
+            for(const auto& entry : entries)
+                if(convertShaderExtension(entry.extension()).has_value())
+                    sources.emplace_back(entry);
+        }
+
+        for(const auto& source : sources)
+        {
+            Async::GetPool().push_task([source, callback]()
+            {
+                auto& cache = CacheService::Get();
+                std::string name = source.filename().string() + ".spv";
+                auto previous = cache.resolve(name);
+                try
+                {
+                    if(compileFile(source, name) && cache.resolve(name) != previous)
+                        callback(name);
+                }
+                catch(const std::exception& e)
+                {
+                    log::error("Failed to compile {}: {}", name, e.what());
+                }
+            });
         }
     }
 }
\ No newline at end of file
@@ -14,34 +14,51 @@ namespace ler
     {
     public:
 
-        struct IncludePack
-        {
-            Blob binary;
-            std::unique_ptr<IncludeResult> result;
-        };
+        using Content = std::shared_ptr<const Blob>;
 
-        void addInclude(const std::string& include);
+        // Thread safe, includes are loaded once, each result shares the content until glslang releases it
+        Content addInclude(const std::string& include);
+        bool reload(const std::string& include);
+        [[nodiscard]] std::vector<std::string> getIncludes();
         IncludeResult* includeSystem(const char* include, const char* shader, size_t size) override;
         IncludeResult* includeLocal(const char* include, const char* shader, size_t size) override;
-        void releaseInclude(IncludeResult* result) override {};
+        void releaseInclude(IncludeResult* result) override;
 
     private:
 
-        std::unordered_map<std::string,IncludePack> m_includes;
+        IncludeResult* findInclude(const char* include);
+
+        std::shared_mutex m_mutex;
+        std::unordered_map<std::string,Content> m_includes;
     };
 
     class GlslangInitializer
     {
     public:
 
+        // Bump when compile options change
+        static constexpr uint32_t kShaderCacheVersion = 1;
+
         GlslangInitializer();
         ~GlslangInitializer();
 
         static bool compile(glslang::TShader* shader, const std::string& code, EShMessages controls, const std::string& shaderName, const std::string& entryPointName = "main");
         static std::vector<uint32_t> compileGlslToSpv(const std::string& code, const fs::path& name);
-        static void compileFile(const fs::path& input, const fs::path& output);
+        static std::string preprocess(const std::string& code, const fs::path& name);
+        static std::string getOptions();
+
+        // Release strips debug info and runs the SPIRV-Tools optimizer, both variants are cached separately
+        static void setReleaseMode(bool release);
+        static bool isReleaseMode();
+        static std::vector<uint32_t> optimize(const std::vector<uint32_t>& spv, const std::string& name);
+        // Compiled SPIR-V is stored in the CacheService under the output name
+        static bool compileFile(const fs::path& input, const std::string& output);
         static void shaderAutoCompile();
 
+        // Recompile shaders affected by a changed file, callback runs on a worker thread
+        using ReloadCallback = std::function<void(const std::string&)>;
+        static void reloadAsync(const fs::path& path, const ReloadCallback& callback);
+
         static DirStackFileIncluder& Includer();
     };
 }
@@ -18,6 +18,20 @@
 #include <pwd.h>
 #endif
 
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <set>
+#include <thread>
+#include <cstring>
+
+#ifdef LER_IO_URING
+#include <liburing.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
 namespace ler
 {
     std::string getHomeDir()
@@ -215,6 +229,248 @@ namespace ler
         return {};
     }
 
+    bool writeFileAtomic(const fs::path& path, std::span<const char> data)
+    {
+        // Readers either see the old file or the complete new one, each writer gets its own temp file
+        static std::atomic<uint32_t> counter = 0;
+#ifdef _WIN32
+        const auto pid = static_cast<uint64_t>(GetCurrentProcessId());
+#else
+        const auto pid = static_cast<uint64_t>(getpid());
+#endif
+        const size_t thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+        fs::path temp = fs::path(path).concat(fmt::format(".{}.{:x}.{}.tmp", pid, thread, counter.fetch_add(1, std::memory_order_relaxed)));
+        std::ofstream file(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!file)
+            return false;
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        file.close();
+        if(!file)
+            return false;
+
+        std::error_code ec;
+        fs::rename(temp, path, ec);
+        if(ec)
+        {
+            fs::remove(temp, ec);
+            return false;
+        }
+        return true;
+    }
+
+#ifdef LER_IO_URING
+    class UringReader
+    {
+    public:
+
+        static UringReader& Get()
+        {
+            static UringReader reader;
+            return std::ref(reader);
+        }
+
+        [[nodiscard]] bool valid() const { return m_valid; }
+
+        void submit(const fs::path& root, std::vector<ReadRequest>& requests)
+        {
+            std::vector<Pending*> batch;
+            batch.reserve(requests.size());
+            for(auto& req : requests)
+            {
+                const fs::path name = root / req.path;
+                int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+                struct stat st = {};
+                if(fd < 0 || fstat(fd, &st) < 0)
+                {
+                    log::error("File Not Found: {}", name.string());
+                    if(fd >= 0)
+                        close(fd);
+                    Async::GetPool().push_task([cb = std::move(req.callback)](){ cb({}); });
+                    continue;
+                }
+
+                auto* pending = new Pending(fd, 0, Blob(st.st_size), std::move(req.callback));
+                if(pending->data.empty())
+                    finish(pending);
+                else
+                    batch.emplace_back(pending);
+            }
+
+            // One syscall for the whole batch
+            std::lock_guard lock(m_mutex);
+            m_inflight += batch.size();
+            for(Pending* pending : batch)
+                prepare(pending);
+            io_uring_submit(&m_ring);
+        }
+
+    private:
+
+        struct Pending
+        {
+            int fd = -1;
+            size_t offset = 0;
+            Blob data;
+            ReadCallback callback;
+        };
+
+        UringReader()
+        {
+            // Completions are dispatched on the pool, it must outlive the reader
+            Async::GetPool();
+            m_valid = io_uring_queue_init(256, &m_ring, 0) == 0;
+            if(m_valid)
+                m_thread = std::thread(&UringReader::reap, this);
+            else
+                log::warn("io_uring unavailable, fallback to thread pool reads");
+        }
+
+        ~UringReader()
+        {
+            if(!m_valid)
+                return;
+
+            // The sentinel may complete before pending reads, the thread leaves once they are all done
+            {
+                std::lock_guard lock(m_mutex);
+                m_stopping = true;
+                io_uring_sqe* sqe = acquire();
+                io_uring_prep_nop(sqe);
+                io_uring_sqe_set_data(sqe, nullptr);
+                io_uring_submit(&m_ring);
+            }
+
+            m_thread.join();
+            io_uring_queue_exit(&m_ring);
+        }
+
+        io_uring_sqe* acquire()
+        {
+            io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+            while(sqe == nullptr)
+            {
+                // Submission queue is full, flush it to the kernel
+                io_uring_submit(&m_ring);
+                sqe = io_uring_get_sqe(&m_ring);
+            }
+            return sqe;
+        }
+
+        void prepare(Pending* pending)
+        {
+            // A read length is 32 bits, larger files are read in chunks
+            io_uring_sqe* sqe = acquire();
+            auto remaining = static_cast<unsigned int>(std::min<size_t>(pending->data.size() - pending->offset, kMaxReadSize));
+            io_uring_prep_read(sqe, pending->fd, pending->data.data() + pending->offset, remaining, pending->offset);
+            io_uring_sqe_set_data(sqe, pending);
+        }
+
+        static void finish(Pending* pending)
+        {
+            close(pending->fd);
+            Async::GetPool().push_task([cb = std::move(pending->callback), blob = std::move(pending->data)]() mutable
+            {
+                cb(std::move(blob));
+            });
+            delete pending;
+        }
+
+        void reap()
+        {
+            while(true)
+            {
+                io_uring_cqe* cqe = nullptr;
+                if(io_uring_wait_cqe(&m_ring, &cqe) < 0)
+                    continue;
+
+                auto* pending = static_cast<Pending*>(io_uring_cqe_get_data(cqe));
+                int res = cqe->res;
+                io_uring_cqe_seen(&m_ring, cqe);
+
+                if(pending == nullptr)
+                {
+                    std::lock_guard lock(m_mutex);
+                    if(m_inflight == 0)
+                        break;
+                    continue;
+                }
+
+                if(res < 0)
+                {
+                    log::error("io_uring read failed: {}", std::strerror(-res));
+                    pending->data.clear();
+                }
+                else if(res > 0)
+                {
+                    // Short read or next chunk, queue the remaining bytes
+                    pending->offset += res;
+                    if(pending->offset < pending->data.size())
+                    {
+                        std::lock_guard lock(m_mutex);
+                        prepare(pending);
+                        io_uring_submit(&m_ring);
+                        continue;
+                    }
+                }
+                else
+                {
+                    pending->data.resize(pending->offset);
+                }
+
+                finish(pending);
+
+                std::lock_guard lock(m_mutex);
+                if(--m_inflight == 0 && m_stopping)
+                    break;
+            }
+        }
+
+        static constexpr size_t kMaxReadSize = 1ull << 30;
+
+        io_uring m_ring = {};
+        bool m_valid = false;
+        // Guarded by the mutex, reads submitted and not finished yet
+        size_t m_inflight = 0;
+        bool m_stopping = false;
+        std::mutex m_mutex;
+        std::thread m_thread;
+    };
+#endif
+
+    void IFileSystem::readBatchAsync(std::vector<ReadRequest> requests)
+    {
+        for(auto& req : requests)
+        {
+            Async::GetPool().push_task([this, req = std::move(req)]()
+            {
+                Blob blob;
+                try
+                {
+                    blob = readFile(req.path);
+                }
+                catch(const std::exception& e)
+                {
+                    log::error(e.what());
+                }
+                req.callback(std::move(blob));
+            });
+        }
+    }
+
+    void IFileSystem::readFileAsync(const fs::path& path, ReadCallback callback)
+    {
+        std::vector<ReadRequest> requests;
+        requests.emplace_back(path, std::move(callback));
+        readBatchAsync(std::move(requests));
+    }
+
+    std::future<Blob> IFileSystem::readFileAsync(const fs::path& path)
+    {
+        auto promise = std::make_shared<std::promise<Blob>>();
+        readFileAsync(path, [promise](Blob&& blob){ promise->set_value(std::move(blob)); });
+        return promise->get_future();
+    }
+
     StdFileSystem::StdFileSystem(const fs::path& root) : m_root(root.lexically_normal())
     {
         if(m_root.empty())
@@ -250,6 +506,18 @@ namespace ler
         return result;
     }
 
+    void StdFileSystem::readBatchAsync(std::vector<ReadRequest> requests)
+    {
+#ifdef LER_IO_URING
+        if(UringReader::Get().valid())
+        {
+            UringReader::Get().submit(m_root, requests);
+            return;
+        }
+#endif
+        IFileSystem::readBatchAsync(std::move(requests));
+    }
+
     void StdFileSystem::enumerates(std::vector<fs::path>& entries)
     {
         for(const auto& entry : fs::recursive_directory_iterator(m_root))
@@ -270,6 +538,13 @@ namespace ler
         return path.extension();
     }
 
+    uint64_t StdFileSystem::file_size(const fs::path& path)
+    {
+        std::error_code ec;
+        uint64_t size = fs::file_size(m_root / path, ec);
+        return ec ? 0 : size;
+    }
+
     void FileSystemService::mount(uint8_t tag, const FileSystemPtr& fs)
     {
         std::unique_lock lock(m_mutex);
@@ -313,6 +588,26 @@ namespace ler
         return {};
     }
 
+    void FileSystemService::readFileAsync(uint8_t tag, const fs::path& path, ReadCallback callback)
+    {
+        std::vector<ReadRequest> requests;
+        requests.emplace_back(path, std::move(callback));
+        readBatchAsync(tag, std::move(requests));
+    }
+
+    void FileSystemService::readBatchAsync(uint8_t tag, std::vector<ReadRequest> requests)
+    {
+        std::shared_lock lock(m_mutex);
+        if(m_mountPoints.contains(tag))
+        {
+            m_mountPoints.at(tag)->readBatchAsync(std::move(requests));
+            return;
+        }
+
+        for(auto& req : requests)
+            Async::GetPool().push_task([cb = std::move(req.callback)](){ cb({}); });
+    }
+
     void FileSystemService::enumerates(uint8_t tag, std::vector<fs::path>& entries)
     {
         std::shared_lock lock(m_mutex);
@@ -333,4 +628,109 @@ namespace ler
         }
         return {};
     }
-}
\ No newline at end of file
+
+    FileSystemService::~FileSystemService()
+    {
+#ifdef __linux__
+        if(m_notify >= 0)
+            close(m_notify);
+#endif
+    }
+
+    bool FileSystemService::watch(uint8_t tag)
+    {
+        fs::path root;
+        {
+            std::shared_lock lock(m_mutex);
+            if(m_mountPoints.contains(tag))
+                root = m_mountPoints.at(tag)->directory();
+        }
+
+        if(root.empty())
+        {
+            log::warn("File system {} can not be watched", tag);
+            return false;
+        }
+
+#ifdef __linux__
+        if(m_notify < 0)
+            m_notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(m_notify < 0)
+        {
+            log::error("Failed to init inotify: {}", std::strerror(errno));
+            return false;
+        }
+
+        addWatch(tag, root, {});
+        for(const auto& entry : fs::recursive_directory_iterator(root))
+        {
+            if(entry.is_directory())
+                addWatch(tag, root, entry.path().lexically_relative(root));
+        }
+        log::info("Watch directory: {}", root.string());
+        return true;
+#else
+        log::warn("File watching is not supported on this platform");
+        return false;
+#endif
+    }
+
+    void FileSystemService::addWatch(uint8_t tag, const fs::path& root, const fs::path& directory)
+    {
+#ifdef __linux__
+        int wd = inotify_add_watch(m_notify, (root / directory).c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if(wd >= 0)
+            m_watches[wd] = Watch(tag, root, directory);
+#endif
+    }
+
+    void FileSystemService::poll()
+    {
+#ifdef __linux__
+        if(m_notify < 0)
+            return;
+
+        // Editors often emit several events for a single save
+        std::set<std::pair<uint8_t, fs::path>> changes;
+        alignas(inotify_event) std::array<char, 4096> buffer;
+        while(true)
+        {
+            ssize_t len = read(m_notify, buffer.data(), buffer.size());
+            if(len <= 0)
+                break;
+
+            for(char* ptr = buffer.data(); ptr < buffer.data() + len;)
+            {
+                auto* event = reinterpret_cast<inotify_event*>(ptr);
+                ptr += sizeof(inotify_event) + event->len;
+
+                auto it = m_watches.find(event->wd);
+                if(it == m_watches.end())
+                    continue;
+
+                if(event->mask & IN_IGNORED)
+                {
+                    m_watches.erase(it);
+                    continue;
+                }
+
+                if(event->len == 0)
+                    continue;
+
+                const Watch watch = it->second;
+                const fs::path path = (watch.directory / event->name).lexically_normal();
+                if(event->mask & IN_ISDIR)
+                    addWatch(watch.tag, watch.root, path);
+                else if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                    changes.emplace(watch.tag, path);
+            }
+        }
+
+        for(const auto& [tag, path] : changes)
+        {
+            log::debug("File changed: {}", path.string());
+            Event::GetDispatcher().enqueue<FileChangeEvent>(tag, path);
+        }
+#endif
+    }
+}
@@ -11,7 +11,9 @@
 #include <ranges>
 #include <bitset>
 #include <variant>
+#include <future>
 #include <fstream>
+#include <functional>
 #include <typeindex>
 #include <filesystem>
 #include <shared_mutex>
@@ -28,9 +30,11 @@ namespace ler
     std::string getHomeDir();
     std::string getCpuName();
     unsigned int getRamCapacity();
+    bool writeFileAtomic(const fs::path& path, std::span<const char> data);
 
     static const fs::path ASSETS_DIR = fs::path(PROJECT_DIR) / "assets";
     static const fs::path CACHED_DIR = fs::path("cached");
+    static const fs::path SHADER_DIR = fs::path(LER_SHADER_DIR);
 
     static constexpr uint32_t C08Mio =  8 * 1024 * 1024;
     static constexpr uint32_t C16Mio = 16 * 1024 * 1024;
@@ -109,10 +113,24 @@ namespace ler
         FsTag_Default = 0,
         FsTag_Cache = 1,
         FsTag_Assets = 2,
-        FsTag_Assimp = 3
+        FsTag_Assimp = 3,
+        FsTag_Shaders = 4
     };
 
     using Blob = std::vector<char>;
+    using ReadCallback = std::function<void(Blob&&)>;
+
+    struct ReadRequest
+    {
+        fs::path path;
+        ReadCallback callback;
+    };
+
+    struct FileChangeEvent
+    {
+        uint8_t tag = FsTag_Default;
+        fs::path path;
+    };
 
     class IFileSystem
     {
@@ -120,10 +138,18 @@ namespace ler
 
         virtual ~IFileSystem() = default;
         virtual Blob readFile(const fs::path& path) = 0;
+        // Callbacks run on the loader threads, an empty blob means the read failed
+        virtual void readBatchAsync(std::vector<ReadRequest> requests);
+        void readFileAsync(const fs::path& path, ReadCallback callback);
+        std::future<Blob> readFileAsync(const fs::path& path);
         [[nodiscard]] virtual bool exists(const fs::path& path) const = 0;
         virtual void enumerates(std::vector<fs::path>& entries) = 0;
         [[nodiscard]] virtual fs::file_time_type last_write_time(const fs::path& path) = 0;
         [[nodiscard]] virtual fs::path format_hint(const fs::path& path) = 0;
+        // Bytes a read would produce, zero when unknown
+        [[nodiscard]] virtual uint64_t file_size(const fs::path& path) { return 0; }
+        // Native directory backing the file system, empty when it can not be watched
+        [[nodiscard]] virtual fs::path directory() const { return {}; }
     };
 
     using FileSystemPtr = std::shared_ptr<IFileSystem>;
@@ -142,10 +168,13 @@ namespace ler
 
         explicit StdFileSystem(const fs::path& root);
         Blob readFile(const fs::path& path) override;
+        void readBatchAsync(std::vector<ReadRequest> requests) override;
         [[nodiscard]] bool exists(const fs::path& path) const override;
         void enumerates(std::vector<fs::path>& entries) override;
         [[nodiscard]] fs::file_time_type last_write_time(const fs::path& path) override;
         fs::path format_hint(const fs::path& path) override;
+        [[nodiscard]] uint64_t file_size(const fs::path& path) override;
+        [[nodiscard]] fs::path directory() const override { return m_root; }
 
     private:
 
@@ -162,15 +191,33 @@ namespace ler
         static const FileSystemPtr& Get(uint8_t tag);
 
         Blob readFile(uint8_t tag, const fs::path& path);
+        void readFileAsync(uint8_t tag, const fs::path& path, ReadCallback callback);
+        void readBatchAsync(uint8_t tag, std::vector<ReadRequest> requests);
         [[nodiscard]] bool exists(uint8_t tag, const fs::path& path);
         void enumerates(uint8_t tag, std::vector<fs::path>& entries);
         [[nodiscard]] fs::file_time_type last_write_time(uint8_t tag, const fs::path& path);
 
+        // Publish FileChangeEvent for modified files, main thread only
+        bool watch(uint8_t tag);
+        void poll();
+
     private:
 
         FileSystemService() = default;
+        ~FileSystemService();
+        void addWatch(uint8_t tag, const fs::path& root, const fs::path& directory);
+
+        struct Watch
+        {
+            uint8_t tag = FsTag_Default;
+            fs::path root;
+            fs::path directory;
+        };
+
         std::unordered_map<uint8_t,FileSystemPtr> m_mountPoints;
         mutable std::shared_mutex m_mutex;
+        std::unordered_map<int,Watch> m_watches;
+        int m_notify = -1;
     };
 }
 
@@ -4,7 +4,9 @@
 
 #define VMA_IMPLEMENTATION
 #include "ler_vki.hpp"
+#include "ler_sys.hpp"
 #include <ranges>
+#include <cstring>
 
 VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 
@@ -15,11 +17,75 @@ namespace ler
         return phyDev.getProperties().deviceType == vk::PhysicalDeviceType::eDiscreteGpu;
     }
 
+    static const fs::path PIPELINE_CACHE = CACHED_DIR / "pipeline.bin";
+
     VulkanInitializer::~VulkanInitializer()
     {
+        SavePipelineCache(m_context);
+        for(VmaPool pool : m_context.memoryPools)
+        {
+            if(pool)
+                vmaDestroyPool(m_context.allocator, pool);
+        }
         vmaDestroyAllocator(m_context.allocator);
     }
 
+    vk::UniquePipelineCache VulkanInitializer::LoadPipelineCache(vk::Device device, const vk::PhysicalDeviceProperties& props)
+    {
+        std::vector<char> blob;
+        std::ifstream file(PIPELINE_CACHE, std::ios::in | std::ios::binary | std::ios::ate);
+        if(file.is_open())
+        {
+            blob.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            file.read(blob.data(), static_cast<std::streamsize>(blob.size()));
+        }
+
+        // A cache from another driver or GPU is ignored by the spec, but we prefer to discard it explicitly
+        VkPipelineCacheHeaderVersionOne header = {};
+        if(blob.size() >= sizeof(header))
+            std::memcpy(&header, blob.data(), sizeof(header));
+
+        bool valid = blob.size() >= sizeof(header);
+        valid &= header.headerSize >= sizeof(header);
+        valid &= header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE;
+        valid &= header.vendorID == props.vendorID;
+        valid &= header.deviceID == props.deviceID;
+        valid &= std::memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+
+        vk::PipelineCacheCreateInfo cacheInfo;
+        if(valid)
+        {
+            cacheInfo.setInitialDataSize(blob.size());
+            cacheInfo.setPInitialData(blob.data());
+            log::info("Load pipeline cache: {} Ko", blob.size() / 1024);
+        }
+        else if(!blob.empty())
+        {
+            log::warn("Discard incompatible pipeline cache");
+        }
+
+        return device.createPipelineCacheUnique(cacheInfo);
+    }
+
+    bool VulkanInitializer::SavePipelineCache(const VulkanContext& context)
+    {
+        if(!context.pipelineCache)
+            return false;
+
+        std::vector<uint8_t> data = context.device.getPipelineCacheData(context.pipelineCache);
+        std::error_code ec;
+        fs::create_directories(PIPELINE_CACHE.parent_path(), ec);
+        if(!writeFileAtomic(PIPELINE_CACHE, std::span(reinterpret_cast<const char*>(data.data()), data.size())))
+        {
+            log::error("Failed to save pipeline cache");
+            return false;
+        }
+
+        log::debug("Save pipeline cache: {} Ko", data.size() / 1024);
+        return true;
+    }
+
     VulkanInitializer::VulkanInitializer(ler::LerConfig& cfg)
     {
         static const vk::DynamicLoader dl;
@@ -98,6 +164,27 @@ namespace ler
         bool supportRayTracing = supportedExtensionSet.contains(VK_KHR_RAY_QUERY_EXTENSION_NAME);
         log::info("Support Ray Tracing: {}", supportRayTracing);
 
+        // Optional, pipeline variants are linked from precompiled parts
+        bool supportPipelineLibrary = supportedExtensionSet.contains(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+                                      supportedExtensionSet.contains(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+        if(supportPipelineLibrary)
+        {
+            auto chain = m_physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>();
+            supportPipelineLibrary = chain.get<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>().graphicsPipelineLibrary;
+        }
+        if(supportPipelineLibrary)
+        {
+            devices.emplace_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+            devices.emplace_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+        }
+        log::info("Support Pipeline Library: {}", supportPipelineLibrary);
+
+        // Optional, ballot compaction in compute needs full subgroups of a known size
+        auto subgroupChain = m_physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan13Features>();
+        const auto& subgroupFeatures = subgroupChain.get<vk::PhysicalDeviceVulkan13Features>();
+        bool supportFullSubgroups = subgroupFeatures.subgroupSizeControl && subgroupFeatures.computeFullSubgroups;
+        log::info("Support Full Subgroups: {}", supportFullSubgroups);
+
         // Device Features
         auto features = m_physicalDevice.getFeatures();
 
@@ -113,33 +200,49 @@ namespace ler
         m_graphicsQueueFamily = std::distance(queueFamilies.begin(), family);
         m_transferQueueFamily = UINT32_MAX;
 
-        // Find Transfer Queue (for parallel command)
-        for(size_t i = 0; i < queueFamilies.size(); ++i)
+        // Find Transfer Queue (for parallel command), a transfer only family first
+        auto findFamily = [&](vk::QueueFlags required, vk::QueueFlags excluded, uint32_t skip)
         {
-            if(queueFamilies[i].queueCount > 0 && queueFamilies[i].queueFlags & vk::QueueFlagBits::eTransfer && m_graphicsQueueFamily != i)
+            for(uint32_t i = 0; i < queueFamilies.size(); ++i)
             {
-                m_transferQueueFamily = i;
-                break;
+                const vk::QueueFlags flags = queueFamilies[i].queueFlags;
+                if(queueFamilies[i].queueCount > 0 && (flags & required) == required && !(flags & excluded) && i != skip)
+                    return i;
             }
-        }
+            return UINT32_MAX;
+        };
+
+        m_transferQueueFamily = findFamily(vk::QueueFlagBits::eTransfer, vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute, m_graphicsQueueFamily);
+        if(m_transferQueueFamily == UINT32_MAX)
+            m_transferQueueFamily = findFamily(vk::QueueFlagBits::eTransfer, {}, m_graphicsQueueFamily);
 
         if(m_transferQueueFamily == UINT32_MAX)
             throw std::runtime_error("No transfer queue available");
 
+        // Find Compute Queue (async compute), optional
+        m_computeQueueFamily = findFamily(vk::QueueFlagBits::eCompute, vk::QueueFlagBits::eGraphics, m_transferQueueFamily);
+        log::info("Support Async Compute: {}", m_computeQueueFamily != UINT32_MAX);
+
         // Create queues
         float queuePriority = 1.0f;
-        std::initializer_list<vk::DeviceQueueCreateInfo> queueCreateInfos = {
+        std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos = {
                 { {}, m_graphicsQueueFamily, 1, &queuePriority },
                 { {}, m_transferQueueFamily, 1, &queuePriority },
         };
+        if(m_computeQueueFamily != UINT32_MAX)
+            queueCreateInfos.emplace_back(vk::DeviceQueueCreateFlags(), m_computeQueueFamily, 1, &queuePriority);
 
         for(auto& q : queueCreateInfos)
             log::info("Queue Family {}: {}", q.queueFamilyIndex, vk::to_string(queueFamilies[q.queueFamilyIndex].queueFlags));
 
         vk::PhysicalDeviceProperties2 p2;
         vk::PhysicalDeviceSubgroupProperties subgroupProps;
+        vk::PhysicalDeviceSubgroupSizeControlProperties sizeControlProps;
         p2.pNext = &subgroupProps;
+        subgroupProps.pNext = &sizeControlProps;
         m_physicalDevice.getProperties2(&p2);
+        if(!(sizeControlProps.requiredSubgroupSizeStages & vk::ShaderStageFlagBits::eCompute))
+            supportFullSubgroups = false;
         log::info("SubgroupSize: {}", subgroupProps.subgroupSize);
         log::info("Subgroup Support: {}", vk::to_string(subgroupProps.supportedOperations));
 
@@ -177,6 +280,8 @@ namespace ler
         vulkan13Features.setMaintenance4(true);
         vulkan13Features.setDynamicRendering(true);
         vulkan13Features.setSynchronization2(true);
+        vulkan13Features.setSubgroupSizeControl(supportFullSubgroups);
+        vulkan13Features.setComputeFullSubgroups(supportFullSubgroups);
 
         vk::StructureChain<vk::DeviceCreateInfo,
                 vk::PhysicalDeviceRayQueryFeaturesKHR,
@@ -184,18 +289,22 @@ namespace ler
                 vk::PhysicalDeviceAccelerationStructureFeaturesKHR,
                 vk::PhysicalDeviceVulkan11Features,
                 vk::PhysicalDeviceVulkan12Features,
-                vk::PhysicalDeviceVulkan13Features> createInfoChain(
+                vk::PhysicalDeviceVulkan13Features,
+                vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT> createInfoChain(
                         deviceInfo,
                         {supportRayTracing},
                         {supportRayTracing},
                         /*{false},*/
                         vulkan11Features,
                         vulkan12Features,
-                        vulkan13Features);
+                        vulkan13Features,
+                        {supportPipelineLibrary});
+        if(!supportPipelineLibrary)
+            createInfoChain.unlink<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>();
         m_device = m_physicalDevice.createDeviceUnique(createInfoChain.get<vk::DeviceCreateInfo>());
         VULKAN_HPP_DEFAULT_DISPATCHER.init(m_device.get());
 
-        m_pipelineCache = m_device->createPipelineCacheUnique({});
+        m_pipelineCache = LoadPipelineCache(m_device.get(), props);
 
         // Create Memory Allocator
         VmaAllocatorCreateInfo allocatorCreateInfo = {};
@@ -215,7 +324,84 @@ namespace ler
         m_context.physicalDevice = m_physicalDevice;
         m_context.graphicsQueueFamily = m_graphicsQueueFamily;
         m_context.transferQueueFamily = m_transferQueueFamily;
+        m_context.computeQueueFamily = m_computeQueueFamily;
+        m_context.subgroupSize = subgroupProps.subgroupSize;
+        m_context.pipelineLibrary = supportPipelineLibrary;
+        m_context.fullSubgroups = supportFullSubgroups;
         m_context.pipelineCache = m_pipelineCache.get();
         m_context.allocator = allocator;
+        createMemoryPools();
+    }
+
+    void VulkanInitializer::createMemoryPools()
+    {
+        using bu = vk::BufferUsageFlagBits;
+        using iu = vk::ImageUsageFlagBits;
+        std::vector<uint32_t> families = {m_graphicsQueueFamily, m_computeQueueFamily};
+        if(m_transferQueueFamily != m_graphicsQueueFamily && m_transferQueueFamily != m_computeQueueFamily)
+            families.emplace_back(m_transferQueueFamily);
+        const bool concurrent = m_computeQueueFamily != UINT32_MAX;
+
+        // Representative resources pick the memory type of each pool
+        vk::BufferCreateInfo bufferInfo;
+        bufferInfo.setSize(65536);
+        bufferInfo.setUsage(bu::eTransferSrc | bu::eTransferDst | bu::eShaderDeviceAddress | bu::eStorageBuffer | bu::eUniformBuffer |
+                            bu::eVertexBuffer | bu::eIndexBuffer | bu::eIndirectBuffer);
+        if(concurrent)
+            bufferInfo.setSharingMode(vk::SharingMode::eConcurrent).setQueueFamilyIndices(families);
+
+        vk::ImageCreateInfo imageInfo;
+        imageInfo.setImageType(vk::ImageType::e2D);
+        imageInfo.setExtent(vk::Extent3D(1024, 1024, 1));
+        imageInfo.setMipLevels(1);
+        imageInfo.setArrayLayers(1);
+        imageInfo.setSamples(vk::SampleCountFlagBits::e1);
+        imageInfo.setTiling(vk::ImageTiling::eOptimal);
+        imageInfo.setFormat(vk::Format::eR8G8B8A8Unorm);
+        imageInfo.setUsage(iu::eSampled | iu::eTransferDst | iu::eTransferSrc);
+
+        struct PoolDesc
+        {
+            MemoryClass memoryClass;
+            VmaAllocationCreateFlags flags;
+            VkDeviceSize blockSize;
+        };
+
+        static constexpr std::array<PoolDesc, MemoryClass_Count> descs = {{
+            {MemoryClass_Geometry, 0, 256ull * 1024 * 1024},
+            {MemoryClass_Texture, 0, 256ull * 1024 * 1024},
+            {MemoryClass_RenderTarget, 0, 128ull * 1024 * 1024},
+            {MemoryClass_Storage, 0, 32ull * 1024 * 1024},
+            {MemoryClass_Constant, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, 16ull * 1024 * 1024}
+        }};
+
+        for(const PoolDesc& desc : descs)
+        {
+            VmaAllocationCreateInfo allocInfo = {};
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            allocInfo.flags = desc.flags;
+
+            VkResult res;
+            uint32_t memoryTypeIndex = 0;
+            if(desc.memoryClass == MemoryClass_Texture || desc.memoryClass == MemoryClass_RenderTarget)
+            {
+                if(desc.memoryClass == MemoryClass_RenderTarget)
+                {
+                    imageInfo.setFormat(vk::Format::eR16G16B16A16Sfloat);
+                    imageInfo.setUsage(iu::eColorAttachment | iu::eSampled | iu::eStorage | iu::eTransferSrc);
+                    if(concurrent)
+                        imageInfo.setSharingMode(vk::SharingMode::eConcurrent).setQueueFamilyIndices(families);
+                }
+                res = vmaFindMemoryTypeIndexForImageInfo(m_context.allocator, reinterpret_cast<VkImageCreateInfo*>(&imageInfo), &allocInfo, &memoryTypeIndex);
+            }
+            else
+                res = vmaFindMemoryTypeIndexForBufferInfo(m_context.allocator, reinterpret_cast<VkBufferCreateInfo*>(&bufferInfo), &allocInfo, &memoryTypeIndex);
+
+            VmaPoolCreateInfo poolInfo = {};
+            poolInfo.memoryTypeIndex = memoryTypeIndex;
+            poolInfo.blockSize = desc.blockSize;
+            if(res != VK_SUCCESS || vmaCreatePool(m_context.allocator, &poolInfo, &m_context.memoryPools[desc.memoryClass]) != VK_SUCCESS)
+                log::warn("Failed to create memory pool {}, using default heaps", uint32_t(desc.memoryClass));
+        }
     }
 }
\ No newline at end of file
@@ -20,6 +20,17 @@ namespace fs = std::filesystem;
 
 namespace ler
 {
+    // Resources of a class share large VMA blocks instead of one vkAllocateMemory each
+    enum MemoryClass : uint32_t
+    {
+        MemoryClass_Geometry,
+        MemoryClass_Texture,
+        MemoryClass_RenderTarget,
+        MemoryClass_Storage,
+        MemoryClass_Constant,
+        MemoryClass_Count
+    };
+
     struct VulkanContext
     {
         vk::Instance instance;
@@ -27,7 +38,12 @@ namespace ler
         vk::Device device;
         uint32_t graphicsQueueFamily = UINT32_MAX;
         uint32_t transferQueueFamily = UINT32_MAX;
+        uint32_t computeQueueFamily = UINT32_MAX;
+        uint32_t subgroupSize = 32;
+        bool pipelineLibrary = false;
+        bool fullSubgroups = false;
         VmaAllocator allocator = nullptr;
+        std::array<VmaPool, MemoryClass_Count> memoryPools = {};
         vk::PipelineCache pipelineCache;
     };
 
@@ -39,6 +55,10 @@ namespace ler
         bool debug = true;
         bool vsync = true;
         bool msaa = true;
+        bool shaderRelease = false;
+        bool shaderAutoCompile = false;
+        uint32_t framesInFlight = 2;
+        uint64_t cacheBudget = 512ull * 1024 * 1024;
 
         std::vector<const char*> extensions;
     };
@@ -51,11 +71,18 @@ namespace ler
         explicit VulkanInitializer(LerConfig& cfg);
         [[nodiscard]] const VulkanContext& getVulkanContext() const { return m_context; }
 
+        // Persisted in CACHED_DIR, validated against the current device
+        static bool SavePipelineCache(const VulkanContext& context);
+
     private:
 
+        static vk::UniquePipelineCache LoadPipelineCache(vk::Device device, const vk::PhysicalDeviceProperties& props);
+        void createMemoryPools();
+
         vk::UniqueInstance m_instance;
         uint32_t m_graphicsQueueFamily = UINT32_MAX;
         uint32_t m_transferQueueFamily = UINT32_MAX;
+        uint32_t m_computeQueueFamily = UINT32_MAX;
         vk::UniqueDevice m_device;
         vk::PhysicalDevice m_physicalDevice;
         vk::UniquePipelineCache m_pipelineCache;
@@ -0,0 +1,18 @@
+//
+// Created by loulfy on 19/10/2026.
+//
+
+#include "ler_pak.hpp"
+#include "ler_log.hpp"
+
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        ler::log::error("Usage: ler_pak <directory> <archive> [level]");
+        return 1;
+    }
+
+    int level = argc > 3 ? std::atoi(argv[3]) : 9;
+    return ler::PakFileSystem::Build(argv[1], argv[2], level) ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+//
+// Created by loulfy on 19/10/2026.
+//
+
+#include "ler_spv.hpp"
+#include "ler_log.hpp"
+
+// Make rule syntax, spaces are escaped
+static std::string escapeDependency(const fs::path& path)
+{
+    std::string result;
+    for(char c : path.generic_string())
+    {
+        if(c == ' ')
+            result += '\\';
+        result += c;
+    }
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        ler::log::error("Usage: ler_shaderc <source> <output> [--depfile <file>] [--release]");
+        return 1;
+    }
+
+    const fs::path input = fs::absolute(argv[1]);
+    const fs::path output = argv[2];
+    fs::path depfile;
+    bool release = false;
+    for(int i = 3; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if(arg == "--release")
+            release = true;
+        else if(arg == "--depfile" && i + 1 < argc)
+            depfile = argv[++i];
+        else
+        {
+            ler::log::error("Unknown argument: {}", arg);
+            return 1;
+        }
+    }
+
+    // Includes resolve next to the source, as the runtime does with the asset directory
+    auto& service = ler::FileSystemService::Get();
+    service.mount(ler::FsTag_Assets, ler::StdFileSystem::Create(input.parent_path()));
+
+    ler::GlslangInitializer glslang;
+    ler::GlslangInitializer::setReleaseMode(release);
+
+    const ler::Blob blob = service.readFile(ler::FsTag_Assets, input.filename());
+    const std::string src(blob.begin(), blob.end());
+    const std::vector<uint32_t> spv = ler::GlslangInitializer::compileGlslToSpv(src, input.filename());
+    if(spv.empty())
+        return 1;
+
+    std::error_code ec;
+    if(output.has_parent_path())
+        fs::create_directories(output.parent_path(), ec);
+    if(!ler::writeFileAtomic(output, std::span(reinterpret_cast<const char*>(spv.data()), spv.size() * sizeof(uint32_t))))
+    {
+        ler::log::error("Failed to write: {}", output.string());
+        return 1;
+    }
+
+    if(!depfile.empty())
+    {
+        std::string rule = escapeDependency(output) + ": " + escapeDependency(input);
+        for(const std::string& include : ler::GlslangInitializer::Includer().getIncludes())
+            rule += " " + escapeDependency(input.parent_path() / include);
+        rule += "\n";
+        if(!ler::writeFileAtomic(depfile, rule))
+        {
+            ler::log::error("Failed to write: {}", depfile.string());
+            return 1;
+        }
+    }
+
+    return 0;
+}